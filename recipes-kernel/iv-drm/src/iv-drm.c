@@ -0,0 +1,417 @@
+/*
+ * iVeia PL display DRM driver
+ *
+ * (C) Copyright 2021, iVeia, LLC
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file COPYING in the main directory of this archive
+ * for more details.
+ *
+ * A KMS driver for the PL scan-out core also driven by iv-fbdev (enable one
+ * or the other in the device tree).  The core scans out a single, packed,
+ * fixed size and format frame from a physical address, so this is a
+ * drm_simple_display_pipe with one fixed mode and one format.  Buffers are
+ * CMA GEM objects, either dumb buffers or imported dma-bufs (physically
+ * contiguous, e.g. from v4l2 capture or ZAP), and are scanned out in place.
+ * fbdev emulation provides /dev/fbN for legacy applications.
+ *
+ * Device tree:
+ *
+ *	compatible	"iveia,display"
+ *	reg		the scan-out control registers.
+ *	interrupts	optional, the scan-out vsync interrupt.  Without it,
+ *			page flip events are sent at commit, not at vblank.
+ *	resolution	<width height bpp>, bpp 16 (RGB565), 24 (RGB888) or
+ *			32 (XRGB8888).
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <linux/platform_device.h>
+#include <linux/interrupt.h>
+#include <linux/dma-mapping.h>
+#include <linux/io.h>
+
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_connector.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_fb_cma_helper.h>
+#include <drm/drm_fb_helper.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_gem_cma_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_modeset_helper_vtables.h>
+#include <drm/drm_probe_helper.h>
+#include <drm/drm_simple_kms_helper.h>
+#include <drm/drm_vblank.h>
+
+/*********************************************************************
+ *
+ * Globals
+ *
+ *********************************************************************/
+
+#define MODNAME "ivdrm"
+
+#define IV_MAX_WIDTH    4096
+#define IV_MAX_HEIGHT   4096
+
+/*
+ * Scan-out control registers, as in iv-fbdev
+ */
+#define IVFB_REG_SCANOUT_BASE   0x00    // Physical address of the first line, latched at vsync
+#define IVFB_REG_IRQ_STATUS     0x04    // Write 1 to clear
+#define IVFB_IRQ_VSYNC          (1 << 0)
+
+struct ivdrm {
+	struct drm_device drm;
+	struct drm_simple_display_pipe pipe;
+	struct drm_connector connector;
+
+	void __iomem * regs;
+	int irq;
+
+	u32 width;
+	u32 height;
+	u32 format;                     // DRM_FORMAT_*
+	u32 cpp;
+};
+
+#define to_ivdrm(dev) container_of(dev, struct ivdrm, drm)
+
+/*********************************************************************
+ *
+ * Connector
+ *
+ *********************************************************************/
+
+static int ivdrm_connector_get_modes(struct drm_connector * connector)
+{
+	struct ivdrm * ivdrm = to_ivdrm(connector->dev);
+	struct drm_display_mode * mode;
+
+	mode = drm_cvt_mode(connector->dev, ivdrm->width, ivdrm->height, 60, false, false, false);
+	if ( ! mode )
+		return 0;
+
+	mode->type |= DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED;
+	drm_mode_probed_add(connector, mode);
+
+	return 1;
+}
+
+static const struct drm_connector_helper_funcs ivdrm_connector_helper_funcs = {
+	.get_modes = ivdrm_connector_get_modes,
+};
+
+static const struct drm_connector_funcs ivdrm_connector_funcs = {
+	.fill_modes = drm_helper_probe_single_connector_modes,
+	.destroy = drm_connector_cleanup,
+	.reset = drm_atomic_helper_connector_reset,
+	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
+	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
+};
+
+/*********************************************************************
+ *
+ * Display pipe
+ *
+ *********************************************************************/
+
+static void ivdrm_set_scanout(struct ivdrm * ivdrm, struct drm_plane_state * plane_state)
+{
+	dma_addr_t addr = drm_fb_cma_get_gem_addr(plane_state->fb, plane_state, 0);
+
+	iowrite32((u32) addr, ivdrm->regs + IVFB_REG_SCANOUT_BASE);
+}
+
+static enum drm_mode_status ivdrm_pipe_mode_valid(struct drm_simple_display_pipe * pipe,
+	const struct drm_display_mode * mode)
+{
+	struct ivdrm * ivdrm = to_ivdrm(pipe->crtc.dev);
+
+	if ( mode->hdisplay != ivdrm->width || mode->vdisplay != ivdrm->height )
+		return MODE_BAD;
+
+	return MODE_OK;
+}
+
+/*
+ * The core reads whole, packed lines: no stride of its own.
+ */
+static int ivdrm_pipe_check(struct drm_simple_display_pipe * pipe,
+	struct drm_plane_state * plane_state, struct drm_crtc_state * crtc_state)
+{
+	struct ivdrm * ivdrm = to_ivdrm(pipe->crtc.dev);
+	struct drm_framebuffer * fb = plane_state->fb;
+
+	if ( ! fb )
+		return 0;
+
+	if ( fb->pitches[0] != ivdrm->width * ivdrm->cpp ) {
+		DRM_DEBUG_KMS("pitch %u not supported\n", fb->pitches[0]);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void ivdrm_pipe_enable(struct drm_simple_display_pipe * pipe,
+	struct drm_crtc_state * crtc_state, struct drm_plane_state * plane_state)
+{
+	struct ivdrm * ivdrm = to_ivdrm(pipe->crtc.dev);
+
+	ivdrm_set_scanout(ivdrm, plane_state);
+	if ( ivdrm->irq > 0 )
+		drm_crtc_vblank_on(&pipe->crtc);
+}
+
+static void ivdrm_pipe_disable(struct drm_simple_display_pipe * pipe)
+{
+	struct ivdrm * ivdrm = to_ivdrm(pipe->crtc.dev);
+
+	if ( ivdrm->irq > 0 )
+		drm_crtc_vblank_off(&pipe->crtc);
+}
+
+/*
+ * A page flip: the new base is latched at the next vsync, which is also when
+ * the flip's event is sent.
+ */
+static void ivdrm_pipe_update(struct drm_simple_display_pipe * pipe,
+	struct drm_plane_state * old_plane_state)
+{
+	struct ivdrm * ivdrm = to_ivdrm(pipe->crtc.dev);
+	struct drm_crtc * crtc = &pipe->crtc;
+	struct drm_pending_vblank_event * event;
+
+	if ( pipe->plane.state->fb && pipe->crtc.state->active )
+		ivdrm_set_scanout(ivdrm, pipe->plane.state);
+
+	spin_lock_irq(&crtc->dev->event_lock);
+	event = crtc->state->event;
+	if ( event ) {
+		crtc->state->event = NULL;
+		if ( ivdrm->irq > 0 && drm_crtc_vblank_get(crtc) == 0 )
+			drm_crtc_arm_vblank_event(crtc, event);
+		else
+			drm_crtc_send_vblank_event(crtc, event);
+	}
+	spin_unlock_irq(&crtc->dev->event_lock);
+}
+
+/*
+ * The core's vsync interrupt can't be masked, so these only keep DRM's
+ * vblank accounting happy.
+ */
+static int ivdrm_pipe_enable_vblank(struct drm_simple_display_pipe * pipe)
+{
+	return 0;
+}
+
+static void ivdrm_pipe_disable_vblank(struct drm_simple_display_pipe * pipe)
+{
+}
+
+static const struct drm_simple_display_pipe_funcs ivdrm_pipe_funcs = {
+	.mode_valid = ivdrm_pipe_mode_valid,
+	.check = ivdrm_pipe_check,
+	.enable = ivdrm_pipe_enable,
+	.disable = ivdrm_pipe_disable,
+	.update = ivdrm_pipe_update,
+	.prepare_fb = drm_gem_fb_simple_display_pipe_prepare_fb,
+	.enable_vblank = ivdrm_pipe_enable_vblank,
+	.disable_vblank = ivdrm_pipe_disable_vblank,
+};
+
+static irqreturn_t ivdrm_isr(int irq, void * dev_id)
+{
+	struct ivdrm * ivdrm = dev_id;
+	u32 status;
+
+	status = ioread32(ivdrm->regs + IVFB_REG_IRQ_STATUS);
+	if ( ! ( status & IVFB_IRQ_VSYNC ))
+		return IRQ_NONE;
+	iowrite32(IVFB_IRQ_VSYNC, ivdrm->regs + IVFB_REG_IRQ_STATUS);
+
+	drm_crtc_handle_vblank(&ivdrm->pipe.crtc);
+
+	return IRQ_HANDLED;
+}
+
+/*********************************************************************
+ *
+ * DRM device
+ *
+ *********************************************************************/
+
+static const struct drm_mode_config_funcs ivdrm_mode_config_funcs = {
+	.fb_create = drm_gem_fb_create,
+	.atomic_check = drm_atomic_helper_check,
+	.atomic_commit = drm_atomic_helper_commit,
+};
+
+DEFINE_DRM_GEM_CMA_FOPS(ivdrm_fops);
+
+static struct drm_driver ivdrm_driver = {
+	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+
+	.prime_handle_to_fd = drm_gem_prime_handle_to_fd,
+	.prime_fd_to_handle = drm_gem_prime_fd_to_handle,
+	.gem_prime_import_sg_table = drm_gem_cma_prime_import_sg_table,
+	.gem_prime_vmap = drm_gem_cma_prime_vmap,
+	.gem_prime_vunmap = drm_gem_cma_prime_vunmap,
+	.gem_prime_mmap = drm_gem_cma_prime_mmap,
+	.gem_free_object_unlocked = drm_gem_cma_free_object,
+	.gem_vm_ops = &drm_gem_cma_vm_ops,
+	.dumb_create = drm_gem_cma_dumb_create,
+
+	.fops = &ivdrm_fops,
+	.name = MODNAME,
+	.desc = "iVeia PL display",
+	.date = "20210601",
+	.major = 1,
+	.minor = 0,
+};
+
+static int ivdrm_format(u32 bpp, u32 * format)
+{
+	switch ( bpp ) {
+		case 16: *format = DRM_FORMAT_RGB565; return 0;
+		case 24: *format = DRM_FORMAT_RGB888; return 0;
+		case 32: *format = DRM_FORMAT_XRGB8888; return 0;
+		default: return -EINVAL;
+	}
+}
+
+/*********************************************************************
+ *
+ * Module probe/remove
+ *
+ *********************************************************************/
+
+static int ivdrm_probe(struct platform_device * pdev)
+{
+	struct ivdrm * ivdrm;
+	struct drm_device * drm;
+	u32 dt_resolution[3];
+	int ret;
+
+	ivdrm = devm_drm_dev_alloc(&pdev->dev, &ivdrm_driver, struct ivdrm, drm);
+	if ( IS_ERR(ivdrm) )
+		return PTR_ERR(ivdrm);
+	drm = &ivdrm->drm;
+	platform_set_drvdata(pdev, ivdrm);
+
+	ret = of_property_read_u32_array(pdev->dev.of_node, "resolution", dt_resolution, 3);
+	if ( ret ) {
+		dev_err(&pdev->dev, "dt ERR: resolution property\n");
+		return ret;
+	}
+	ivdrm->width = dt_resolution[0];
+	ivdrm->height = dt_resolution[1];
+	if ( ivdrm->width == 0 || ivdrm->width > IV_MAX_WIDTH
+		|| ivdrm->height == 0 || ivdrm->height > IV_MAX_HEIGHT
+		|| ivdrm_format(dt_resolution[2], &ivdrm->format) )
+	{
+		dev_err(&pdev->dev, "dt ERR: resolution %u x %u, %u bpp not supported\n",
+			dt_resolution[0], dt_resolution[1], dt_resolution[2]);
+		return -EINVAL;
+	}
+	ivdrm->cpp = dt_resolution[2] / 8;
+
+	ivdrm->regs = devm_platform_ioremap_resource(pdev, 0);
+	if ( IS_ERR(ivdrm->regs) )
+		return PTR_ERR(ivdrm->regs);
+
+	// The scan-out base register is 32 bits
+	ret = dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32));
+	if ( ret )
+		return ret;
+
+	ret = drmm_mode_config_init(drm);
+	if ( ret )
+		return ret;
+	drm->mode_config.min_width = ivdrm->width;
+	drm->mode_config.max_width = ivdrm->width;
+	drm->mode_config.min_height = ivdrm->height;
+	drm->mode_config.max_height = ivdrm->height;
+	drm->mode_config.preferred_depth = dt_resolution[2] == 16 ? 16 : 24;
+	drm->mode_config.funcs = &ivdrm_mode_config_funcs;
+
+	drm_connector_helper_add(&ivdrm->connector, &ivdrm_connector_helper_funcs);
+	ret = drm_connector_init(drm, &ivdrm->connector, &ivdrm_connector_funcs, DRM_MODE_CONNECTOR_DPI);
+	if ( ret )
+		return ret;
+
+	ret = drm_simple_display_pipe_init(drm, &ivdrm->pipe, &ivdrm_pipe_funcs,
+			&ivdrm->format, 1, NULL, &ivdrm->connector);
+	if ( ret )
+		return ret;
+
+	ivdrm->irq = platform_get_irq_optional(pdev, 0);
+	if ( ivdrm->irq == -EPROBE_DEFER )
+		return ivdrm->irq;
+	if ( ivdrm->irq > 0 ) {
+		ret = drm_vblank_init(drm, 1);
+		if ( ret )
+			return ret;
+		ret = devm_request_irq(&pdev->dev, ivdrm->irq, ivdrm_isr, 0, MODNAME, ivdrm);
+		if ( ret )
+			return ret;
+	}
+
+	drm_mode_config_reset(drm);
+
+	ret = drm_dev_register(drm, 0);
+	if ( ret )
+		return ret;
+
+	drm_fbdev_generic_setup(drm, dt_resolution[2]);
+
+	dev_info(&pdev->dev, "%u x %u, %u bpp%s\n", ivdrm->width, ivdrm->height,
+		dt_resolution[2], ivdrm->irq > 0 ? "" : ", no vblank interrupt");
+
+	return 0;
+}
+
+static int ivdrm_remove(struct platform_device * pdev)
+{
+	struct ivdrm * ivdrm = platform_get_drvdata(pdev);
+
+	drm_dev_unregister(&ivdrm->drm);
+	drm_atomic_helper_shutdown(&ivdrm->drm);
+
+	return 0;
+}
+
+/*********************************************************************
+ *
+ * Module init/exit
+ *
+ *********************************************************************/
+
+/* Match table for OF platform binding */
+static const struct of_device_id ivdrm_of_match[] = {
+	{ .compatible = "iveia,display", },
+	{ /* end of list */ },
+};
+MODULE_DEVICE_TABLE(of, ivdrm_of_match);
+
+static struct platform_driver ivdrm_platform_driver = {
+	.probe	    = ivdrm_probe,
+	.remove     = ivdrm_remove,
+	.driver     = {
+		.name	= MODNAME,
+		.of_match_table = ivdrm_of_match,
+	},
+};
+module_platform_driver(ivdrm_platform_driver);
+
+MODULE_AUTHOR("iVeia, LLC");
+MODULE_DESCRIPTION("iVeia PL display DRM driver");
+MODULE_LICENSE("GPL");
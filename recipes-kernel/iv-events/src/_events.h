@@ -1,5 +1,9 @@
 #ifndef __EVENTS_H_
 #define __EVENTS_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
 /*
  * Ioctl definitions
  */
@@ -7,6 +11,72 @@
 
 #define EVENTS_IOC_R_INSTANCE_COUNT		_IOR(EVENTS_IOC_MAGIC,  0, unsigned long)
 
-#define EVENTS_IOC_MAXNR 0
+/*
+ * Queue mode.  Setting a non-zero depth (in records, rounded up to a power of
+ * two, at most EVENTS_MAX_QUEUE_DEPTH) switches the fd from the pending-mask
+ * protocol to a queue of struct events_record: each interrupt adds one record
+ * per subscribed event, and read() returns as many whole records as fit in
+ * the buffer.  A depth of 0 goes back to the pending mask.
+ *
+ * When the queue is full new records are dropped.  The number dropped is
+ * reported in the overruns field of the next record that is queued, and the
+ * total is returned by EVENTS_IOC_R_OVERRUNS.
+ */
+#define EVENTS_IOC_W_QUEUE_DEPTH		_IOW(EVENTS_IOC_MAGIC,  1, unsigned long)
+#define EVENTS_IOC_R_OVERRUNS			_IOR(EVENTS_IOC_MAGIC,  2, unsigned long)
+
+/*
+ * Event banks.  The core can have up to EVENTS_MAX_BANKS banks of 32 events
+ * (the "num-banks" DT property), giving event numbers 0 to 32 * banks - 1;
+ * EVENTS_IOC_R_NUM_EVENTS returns how many there are.
+ *
+ * write() of a u32 can only reach events 0-30, as bit 31 is the wait-for-all
+ * flag.  EVENTS_IOC_W_SUBSCRIBE sets the events to wait for from a bitmap
+ * of any width, as an array of __u32 words (event N is bit N % 32 of word
+ * N / 32).  Like write(), it replaces the fd's previous subscription.
+ *
+ * read() in pending mode returns the pending subscribed events in the same
+ * format, for as many words as fit in the buffer (a single u32 for the
+ * write() protocol).
+ */
+#define EVENTS_IOC_W_SUBSCRIBE			_IOW(EVENTS_IOC_MAGIC,  3, struct events_subscription)
+#define EVENTS_IOC_R_NUM_EVENTS			_IOR(EVENTS_IOC_MAGIC,  4, unsigned long)
+
+/*
+ * eventfd binding.  EVENTS_IOC_W_EVENTFD binds an eventfd(2) to an event, and
+ * the ISR adds 1 to it on every occurrence, so events can be waited on with
+ * epoll alongside other fds without read()ing this one.  Bind the same
+ * eventfd to several events to wait on a mask.  An fd of -1 removes this
+ * fd's bindings for the event.  Bindings are independent of the write() or
+ * EVENTS_IOC_W_SUBSCRIBE subscription, and go away when this fd is closed.
+ */
+#define EVENTS_IOC_W_EVENTFD			_IOW(EVENTS_IOC_MAGIC,  5, struct events_eventfd)
+
+#define EVENTS_IOC_MAXNR 5
+
+#define EVENTS_MAX_QUEUE_DEPTH	4096
+#define EVENTS_MAX_BANKS	8
+#define EVENTS_MAX_EVENTS	( EVENTS_MAX_BANKS * 32 )
+
+#define EVENTS_SUBSCRIBE_ALL	0x1	/* Wait for all events, instead of any */
+
+struct events_subscription {
+	__u32 flags;		/* EVENTS_SUBSCRIBE_* */
+	__u32 nbits;		/* Width of mask, at most the number of events */
+	__u64 mask;		/* User pointer to (nbits + 31) / 32 __u32 words */
+};
+
+struct events_eventfd {
+	__s32 fd;		/* eventfd, or -1 to unbind */
+	__u32 event;		/* Event number */
+};
+
+struct events_record {
+	__u64 timestamp;	/* CLOCK_MONOTONIC ns, taken in the ISR */
+	__u32 seq;		/* Per-fd sequence number, counts dropped records too */
+	__u32 event;		/* Event number */
+	__u32 count;		/* Occurrences of this event seen by this fd */
+	__u32 overruns;		/* Records dropped just before this one */
+};
 
 #endif
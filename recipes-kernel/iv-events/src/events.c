@@ -42,6 +42,9 @@
 #include <linux/cdev.h>
 #include <linux/poll.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/bitops.h>
 #include <linux/slab.h>
 #include <linux/interrupt.h>
 #include <linux/sched.h>
@@ -49,16 +52,67 @@
 #include <asm/uaccess.h>
 #include <linux/debugfs.h>
 #include <linux/irq.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <linux/eventfd.h>
+#include <linux/log2.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
 
 #include "events.h"
+
+#define MODNAME "events"
+
 #include <linux/ioctl.h>
 
 /*
- * Mapping to vsoc_mem of registers
+ * Mapping to vsoc_mem of registers.  Each bank of 32 events has its own
+ * registers, EVENTS_BANK_STRIDE words apart, and the number of banks comes
+ * from the optional "num-banks" DT property (default 1).
  */
 #define EVENTS_MASK_REG     0
 #define EVENTS_PENDING_REG  1
 #define EVENTS_MASK_EN_REG  2
+#define EVENTS_BANK_STRIDE  4
+
+#define EVENTS_REG(dev, bank, reg) \
+	((dev)->vsoc_mem[(bank) * EVENTS_BANK_STRIDE + (reg)])
+
+/*
+ * Latency histograms, in log2(ns) buckets: bucket i counts latencies of
+ * [2^i, 2^(i+1)) ns, and the last bucket everything longer.
+ */
+#define EVENTS_LAT_BUCKETS	28
+
+struct events_stats {
+	u32 count;				// Occurrences dispatched
+	u32 dispatch[EVENTS_LAT_BUCKETS];	// Hard IRQ to IRQ thread
+	u32 user[EVENTS_LAT_BUCKETS];		// Hard IRQ to read() returning it
+};
+
+/*
+ * Load generator.  Replays a sequence of event masks (events 0-63) through
+ * the same path as a hardware interrupt: each step is latched as if the hard
+ * IRQ handler had seen it, and the IRQ thread woken.  All under debugfs
+ * events/loadgen:
+ *
+ *	sequence	One step per line, "<mask> [<delay_ns>]", replacing the
+ *			whole sequence on each write.  delay_ns is the time to
+ *			the next step, and defaults to period_ns.
+ *	period_ns	Default time between steps
+ *	passes		Times to run through the sequence, 0 for forever
+ *	enable		Write 1 to start from the top, 0 to stop.  Reads 0
+ *			once the passes are done.
+ *	injected	Events injected since the last start
+ */
+#define EVENTS_LG_MAX_STEPS	256
+#define EVENTS_LG_MIN_NS	1000
+
+struct events_lg_step {
+	u64 mask;
+	u64 delay_ns;
+};
 
 struct events_dev {
 	struct class *class;
@@ -71,16 +125,73 @@ struct events_dev {
     	int hw_irq;
     	int irq;
 	int opened;
-	struct list_head filelist;
+	u32 num_banks;
+	int num_events;
+	// Hardware mask management.  want_mask is the union of every file's
+	// subscription; hw_mask is what is enabled in EVENTS_MASK_REG, which is
+	// the wanted events less those that have fired and that every
+	// subscriber still has pending.  Both under hw_lock.
+	spinlock_t hw_lock;
+	u32 want_mask[EVENTS_MAX_BANKS];
+	u32 hw_mask[EVENTS_MAX_BANKS];
+	// Events seen pending while masked, so coalesced with an earlier one
+	u32 masked_counts[EVENTS_MAX_EVENTS];
+	// Events acked by the hard IRQ handler, and when they were first seen,
+	// waiting for the IRQ thread.  Under hw_lock.
+	u32 latched[EVENTS_MAX_BANKS];
+	u64 latched_ts[EVENTS_MAX_EVENTS];
+	// IRQ thread's copy of latched_ts
+	u64 dispatch_ts[EVENTS_MAX_EVENTS];
+	struct events_stats * stats;
+	// Load generator.  Configured with sem held, and only while stopped.
+	struct hrtimer lg_timer;
+	struct events_lg_step lg_steps[EVENTS_LG_MAX_STEPS];
+	int lg_len;
+	int lg_pos;
+	u64 lg_period_ns;
+	u64 lg_passes;
+	u64 lg_pass;
+	bool lg_running;
+	u64 lg_injected;
+	// Subscribers to each event, walked by the ISR under RCU.  Updated
+	// with sem held.
+	struct hlist_head subs[EVENTS_MAX_EVENTS];
 };
 
-struct events_file {
+struct events_file;
+
+struct events_sub {
+	struct hlist_node node;
+	struct events_file * file;
+	// Set for an eventfd binding (EVENTS_IOC_W_EVENTFD), which is owned by
+	// file, on its efds list, but is signalled instead of waking it.
+	struct eventfd_ctx * efd;
+	// Set for an in-kernel waiter (events_waiter_ops), which has no file
+	struct completion * done;
+	int event;
 	struct list_head list;
+	struct rcu_head rcu;
+};
+
+struct events_file {
 	struct events_dev * dev;
 	wait_queue_head_t waitq;
-	u32 pending;
-	u32 pending_mask;
+	DECLARE_BITMAP(pending, EVENTS_MAX_EVENTS);
+	DECLARE_BITMAP(pending_mask, EVENTS_MAX_EVENTS);
+	u64 pending_ts[EVENTS_MAX_EVENTS];	// When each pending bit was set
 	u32 all_events;
+	struct events_sub * subs[EVENTS_MAX_EVENTS];
+	struct list_head efds;
+
+	// Queue mode (see EVENTS_IOC_W_QUEUE_DEPTH).  Filled by the ISR (or
+	// the debugfs trigger) under queue_lock, drained by read().
+	spinlock_t queue_lock;
+	DECLARE_KFIFO_PTR(queue, struct events_record);
+	unsigned long queue_depth;
+	u32 seq;
+	u32 counts[EVENTS_MAX_EVENTS];
+	u32 overruns;
+	unsigned long overruns_total;
 };
 
 static dev_t events_dev_num = 0;
@@ -90,8 +201,11 @@ static struct events_dev *events_dev = NULL;
 static u64 scratch = 0xdeadbeef;
 
 #define ARE_REQUESTED_EVENTS_PENDING(f) \
-	( f->all_events && (( f->pending & f->pending_mask ) == f->pending_mask )) \
-	|| ( ! f->all_events && ( f->pending & f->pending_mask ))
+	(( f->all_events && bitmap_subset(f->pending_mask, f->pending, f->dev->num_events)) \
+	|| ( ! f->all_events && bitmap_intersects(f->pending, f->pending_mask, f->dev->num_events)))
+
+#define IS_READ_READY(f) \
+	( f->queue_depth ? ! kfifo_is_empty(&f->queue) : ARE_REQUESTED_EVENTS_PENDING(f) )
 
 
 static struct of_device_id gic_match[] = {
@@ -130,60 +244,526 @@ unsigned int xlate_irq(unsigned int hwirq)
 }
 
 
-u32 events_get_events(struct events_dev * dev) 
+static inline int events_lat_bucket(u64 ns)
 {
-	return (u32)(dev->vsoc_mem[EVENTS_PENDING_REG]);
+	return ns ? min_t(int, ilog2(ns), EVENTS_LAT_BUCKETS - 1) : 0;
+}
+
+
+u32 events_get_events(struct events_dev * dev, int bank) 
+{
+	return (u32)EVENTS_REG(dev, bank, EVENTS_PENDING_REG);
 }
 
 /*
- * Called from intterupt context to wake_up all read()ers.
+ * Queue a record for a queue-mode file.  If the queue is full the record is
+ * dropped, and the drop is reported with the next one that fits.
  */
-void events_wake_up(struct events_dev * dev, int event)
+static void events_queue_record(struct events_file * pevents_file, int event, u64 timestamp)
 {
-	struct list_head * plist;
-	list_for_each(plist, &dev->filelist) {
-		struct events_file * pevents_file = list_entry(plist, struct events_file, list);
-		pevents_file->pending |= (1 << event);
-		if ( ARE_REQUESTED_EVENTS_PENDING(pevents_file)) {
+	struct events_record rec;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pevents_file->queue_lock, flags);
+
+	// Recheck under the lock, the queue may have just been switched off
+	if ( ! pevents_file->queue_depth )
+		goto out;
+
+	pevents_file->counts[event]++;
+
+	rec.timestamp = timestamp;
+	rec.seq = pevents_file->seq++;
+	rec.event = event;
+	rec.count = pevents_file->counts[event];
+	rec.overruns = pevents_file->overruns;
+
+	if ( kfifo_put(&pevents_file->queue, rec) ) {
+		pevents_file->overruns = 0;
+	} else {
+		pevents_file->overruns++;
+		pevents_file->overruns_total++;
+	}
+
+out:
+	spin_unlock_irqrestore(&pevents_file->queue_lock, flags);
+}
+
+/*
+ * Called from the IRQ thread to wake_up the read()ers subscribed to event.
+ * Returns true if a subscriber wants to hear about the next occurrence too,
+ * i.e. it is in queue mode.  The others already have the event pending.
+ */
+bool events_wake_up(struct events_dev * dev, int event, u64 timestamp)
+{
+	struct events_sub * sub;
+	bool more = false;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(sub, &dev->subs[event], node) {
+		struct events_file * pevents_file = sub->file;
+		if ( sub->efd ) {
+			// eventfds count every occurrence
+			eventfd_signal(sub->efd, 1);
+			more = true;
+			continue;
+		}
+		if ( sub->done ) {
+			complete(sub->done);
+			more = true;
+			continue;
+		}
+		if ( ! test_and_set_bit(event, pevents_file->pending) )
+			pevents_file->pending_ts[event] = timestamp;
+		if ( pevents_file->queue_depth ) {
+			events_queue_record(pevents_file, event, timestamp);
+			more = true;
+		}
+		if ( IS_READ_READY(pevents_file)) {
 			wake_up_interruptible( &pevents_file->waitq );
 		}
 	}
+	rcu_read_unlock();
 
-	return;
+	return more;
 }
 	
 
 /*
- * For each pending event, clears it and wakes up read()ers.
+ * IRQ thread: for each event latched by events_isr(), wakes up read()ers.
+ *
+ * Afterwards, an event that fired stays masked until a subscriber can take
+ * another one (see events_arm()); everything else stays enabled.  Wanted
+ * events are masked before their subscribers are woken, and re-armed after
+ * if one is in queue mode, so an events_arm() from a woken read()er always
+ * finds its event masked, and takes effect.  Occurrences in between are
+ * still latched in EVENTS_PENDING_REG.
  */
 void events_foreach_wake_up(struct events_dev * dev)
 {
-	volatile unsigned int pending = dev->vsoc_mem[EVENTS_PENDING_REG];
-	volatile unsigned int events = pending;
+	u64 now = ktime_get_ns();
+	u32 latched[EVENTS_MAX_BANKS];
+	u32 wake[EVENTS_MAX_BANKS];
+	unsigned long events;
+	unsigned long flags;
+	u32 more;
+	int bank;
 	int i;
-
-	for ( i = 0; i < 31; i++ ) {
-		if ( events & 1 )
-			events_wake_up(dev, i);
-		events >>= 1;
+	int e;
+
+	spin_lock_irqsave(&dev->hw_lock, flags);
+	for ( bank = 0; bank < dev->num_banks; bank++ ) {
+		latched[bank] = dev->latched[bank];
+		dev->latched[bank] = 0;
+		events = latched[bank];
+		for_each_set_bit(i, &events, 32)
+			dev->dispatch_ts[bank * 32 + i] = dev->latched_ts[bank * 32 + i];
+
+		wake[bank] = latched[bank] & dev->want_mask[bank];
+		if ( dev->hw_mask[bank] & wake[bank] ) {
+			dev->hw_mask[bank] &= ~wake[bank];
+			EVENTS_REG(dev, bank, EVENTS_MASK_REG) = dev->hw_mask[bank];
+		}
 	}
-	// clear the events
-	dev->vsoc_mem[EVENTS_PENDING_REG] = pending;
+	spin_unlock_irqrestore(&dev->hw_lock, flags);
+
+	for ( bank = 0; bank < dev->num_banks; bank++ ) {
+		if ( ! latched[bank] )
+			continue;
+
+		more = 0;
+		events = latched[bank];
+		for_each_set_bit(i, &events, 32) {
+			e = bank * 32 + i;
+			dev->stats[e].count++;
+			dev->stats[e].dispatch[events_lat_bucket(now - dev->dispatch_ts[e])]++;
+			if ( ! ( wake[bank] & ( 1 << i )))
+				continue;
+			if ( events_wake_up(dev, e, dev->dispatch_ts[e]) )
+				more |= 1 << i;
+		}
 
-	// disable all events from reporting interrupt
-	dev->vsoc_mem[EVENTS_MASK_REG] = 0x00000000;
+		// re-arm the events a subscriber can take another one of
+		spin_lock_irqsave(&dev->hw_lock, flags);
+		more &= dev->want_mask[bank] & ~dev->hw_mask[bank];
+		if ( more ) {
+			dev->hw_mask[bank] |= more;
+			EVENTS_REG(dev, bank, EVENTS_MASK_REG) = dev->hw_mask[bank];
+		}
+		spin_unlock_irqrestore(&dev->hw_lock, flags);
+	}
 
 	return;
 }
 
 
+/*
+ * Latch events for the IRQ thread, with the time each was first seen.
+ * Called with hw_lock held.
+ */
+static void events_latch(struct events_dev * dev, int bank, u32 pending, u64 timestamp)
+{
+	unsigned long fresh = pending & ~dev->latched[bank];
+	int i;
+
+	for_each_set_bit(i, &fresh, 32)
+		dev->latched_ts[bank * 32 + i] = timestamp;
+	dev->latched[bank] |= pending;
+}
+
+/*
+ * Hard IRQ handler: latch and clear the pending events, with the time, and
+ * leave the rest to the IRQ thread.  Only banks with events enabled can be
+ * interrupting, so the others aren't read.
+ */
 irqreturn_t events_isr(int irq, void *id)
+{
+	struct events_dev * dev = (struct events_dev *) id;
+	u64 timestamp = ktime_get_ns();
+	irqreturn_t ret = IRQ_HANDLED;
+	unsigned long masked;
+	u32 pending;
+	u32 armed;
+	int bank;
+	int i;
+
+	spin_lock(&dev->hw_lock);
+	for ( bank = 0; bank < dev->num_banks; bank++ ) {
+		armed = dev->hw_mask[bank];
+		if ( ! armed )
+			continue;
+		pending = EVENTS_REG(dev, bank, EVENTS_PENDING_REG);
+		if ( ! pending )
+			continue;
+		// clear the events
+		EVENTS_REG(dev, bank, EVENTS_PENDING_REG) = pending;
+
+		masked = pending & ~armed;
+		for_each_set_bit(i, &masked, 32)
+			dev->masked_counts[bank * 32 + i]++;
+
+		events_latch(dev, bank, pending, timestamp);
+
+		ret = IRQ_WAKE_THREAD;
+	}
+	spin_unlock(&dev->hw_lock);
+
+	return ret;
+}
+
+
+irqreturn_t events_isr_thread(int irq, void *id)
 {
 	events_foreach_wake_up((struct events_dev *) id);
 	return IRQ_HANDLED;
 }
 
 
+/*
+ * Load generator step, in hard IRQ context like events_isr()
+ */
+static enum hrtimer_restart events_lg_timer(struct hrtimer * timer)
+{
+	struct events_dev * dev = container_of(timer, struct events_dev, lg_timer);
+	struct events_lg_step * step = &dev->lg_steps[dev->lg_pos];
+	u64 timestamp = ktime_get_ns();
+	u64 mask = step->mask;
+	int bank;
+
+	if ( dev->num_events < 64 )
+		mask &= ( 1ULL << dev->num_events ) - 1;
+
+	spin_lock(&dev->hw_lock);
+	for ( bank = 0; bank < min_t(int, 2, dev->num_banks); bank++ ) {
+		if ( (u32)( mask >> ( bank * 32 )) )
+			events_latch(dev, bank, (u32)( mask >> ( bank * 32 )), timestamp);
+	}
+	spin_unlock(&dev->hw_lock);
+
+	dev->lg_injected += hweight64(mask);
+	irq_wake_thread(dev->irq, dev);
+
+	hrtimer_forward_now(timer, ns_to_ktime(step->delay_ns ? step->delay_ns : dev->lg_period_ns));
+
+	if ( ++dev->lg_pos == dev->lg_len ) {
+		dev->lg_pos = 0;
+		if ( dev->lg_passes && ++dev->lg_pass >= dev->lg_passes ) {
+			dev->lg_running = false;
+			return HRTIMER_NORESTART;
+		}
+	}
+
+	return HRTIMER_RESTART;
+}
+
+
+
+/*
+ * Subscribe a file to exactly the events in mask.  New subscriptions are
+ * added before old ones are dropped, so on -ENOMEM a call with the previous
+ * mask puts things back without allocating.  Called with dev->sem held.
+ */
+static int events_subscribe(struct events_file * pevents_file, const unsigned long * mask)
+{
+	struct events_dev * dev = pevents_file->dev;
+	struct events_sub * sub;
+	int i;
+
+	for ( i = 0; i < dev->num_events; i++ ) {
+		if ( ! test_bit(i, mask) || pevents_file->subs[i] )
+			continue;
+		sub = kzalloc(sizeof(struct events_sub), GFP_KERNEL);
+		if ( ! sub )
+			return -ENOMEM;
+		sub->file = pevents_file;
+		pevents_file->subs[i] = sub;
+		hlist_add_head_rcu(&sub->node, &dev->subs[i]);
+	}
+
+	for ( i = 0; i < dev->num_events; i++ ) {
+		if ( test_bit(i, mask) || ! pevents_file->subs[i] )
+			continue;
+		hlist_del_rcu(&pevents_file->subs[i]->node);
+		kfree_rcu(pevents_file->subs[i], rcu);
+		pevents_file->subs[i] = NULL;
+	}
+
+	return 0;
+}
+
+/*
+ * Enable the given events in the hardware, those that are still wanted and
+ * not already enabled.
+ */
+static void events_arm(struct events_dev * dev, const unsigned long * events)
+{
+	u32 words[EVENTS_MAX_BANKS];
+	unsigned long flags;
+	int bank;
+
+	bitmap_to_arr32(words, events, dev->num_events);
+
+	spin_lock_irqsave(&dev->hw_lock, flags);
+	for ( bank = 0; bank < dev->num_banks; bank++ ) {
+		words[bank] &= dev->want_mask[bank] & ~dev->hw_mask[bank];
+		if ( ! words[bank] )
+			continue;
+		dev->hw_mask[bank] |= words[bank];
+		// EVENTS_MASK_EN_REG overwrites the mask too, so write all of it
+		EVENTS_REG(dev, bank, EVENTS_MASK_REG) = dev->hw_mask[bank];
+	}
+	spin_unlock_irqrestore(&dev->hw_lock, flags);
+}
+
+/*
+ * Recompute the union of all subscriptions after one changes, and mask the
+ * events nobody wants any more.  Called with dev->sem held.
+ */
+static void events_update_want(struct events_dev * dev)
+{
+	u32 want[EVENTS_MAX_BANKS] = { 0 };
+	unsigned long flags;
+	int bank;
+	int i;
+
+	for ( i = 0; i < dev->num_events; i++ ) {
+		if ( ! hlist_empty(&dev->subs[i]) )
+			want[i / 32] |= 1 << ( i % 32 );
+	}
+
+	spin_lock_irqsave(&dev->hw_lock, flags);
+	for ( bank = 0; bank < dev->num_banks; bank++ ) {
+		dev->want_mask[bank] = want[bank];
+		if ( dev->hw_mask[bank] & ~want[bank] ) {
+			dev->hw_mask[bank] &= want[bank];
+			EVENTS_REG(dev, bank, EVENTS_MASK_REG) = dev->hw_mask[bank];
+		}
+	}
+	spin_unlock_irqrestore(&dev->hw_lock, flags);
+}
+
+/*
+ * Set the events a file waits for, and enable them in the hardware.  Called
+ * with dev->sem held.
+ */
+static int events_set_subscription(struct events_file * pevents_file, const unsigned long * mask, u32 all_events)
+{
+	struct events_dev * dev = pevents_file->dev;
+	int err;
+
+	err = events_subscribe(pevents_file, mask);
+	if ( err ) {
+		events_subscribe(pevents_file, pevents_file->pending_mask);
+		return err;
+	}
+	pevents_file->all_events = all_events;
+	bitmap_copy(pevents_file->pending_mask, mask, dev->num_events);
+
+	events_update_want(dev);
+
+  	// allow these events to cause interrupts
+	events_arm(dev, mask);
+
+	return 0;
+}
+
+/*
+ * Free eventfd bindings that are off the subscriber lists, once the ISR is
+ * done with them.
+ */
+static void events_free_eventfds(struct list_head * list)
+{
+	struct events_sub * sub, * tmp;
+
+	list_for_each_entry_safe(sub, tmp, list, list) {
+		list_del(&sub->list);
+		eventfd_ctx_put(sub->efd);
+		kfree(sub);
+	}
+}
+
+/*
+ * Bind an eventfd to an event, or with an fd of -1, remove the file's
+ * bindings for it.  Called with dev->sem held.
+ */
+static int events_bind_eventfd(struct events_file * pevents_file, struct events_eventfd * pefd)
+{
+	struct events_dev * dev = pevents_file->dev;
+	DECLARE_BITMAP(mask, EVENTS_MAX_EVENTS);
+	struct events_sub * sub, * tmp;
+	struct eventfd_ctx * ctx;
+	LIST_HEAD(gone);
+
+	if ( pefd->event >= dev->num_events )
+		return -EINVAL;
+
+	if ( pefd->fd < 0 ) {
+		list_for_each_entry_safe(sub, tmp, &pevents_file->efds, list) {
+			if ( sub->event != pefd->event )
+				continue;
+			hlist_del_rcu(&sub->node);
+			list_move(&sub->list, &gone);
+		}
+		events_update_want(dev);
+		synchronize_rcu();
+		events_free_eventfds(&gone);
+		return 0;
+	}
+
+	ctx = eventfd_ctx_fdget(pefd->fd);
+	if ( IS_ERR(ctx) )
+		return PTR_ERR(ctx);
+
+	list_for_each_entry(sub, &pevents_file->efds, list) {
+		if ( sub->event == pefd->event && sub->efd == ctx ) {
+			eventfd_ctx_put(ctx);
+			return -EBUSY;
+		}
+	}
+
+	sub = kzalloc(sizeof(struct events_sub), GFP_KERNEL);
+	if ( ! sub ) {
+		eventfd_ctx_put(ctx);
+		return -ENOMEM;
+	}
+	sub->file = pevents_file;
+	sub->efd = ctx;
+	sub->event = pefd->event;
+	list_add(&sub->list, &pevents_file->efds);
+	hlist_add_head_rcu(&sub->node, &dev->subs[pefd->event]);
+
+	events_update_want(dev);
+	bitmap_zero(mask, EVENTS_MAX_EVENTS);
+	set_bit(pefd->event, mask);
+	events_arm(dev, mask);
+
+	return 0;
+}
+
+/*
+ * In-kernel waiters, see events.h
+ */
+struct events_waiter {
+	struct events_sub sub;
+	struct completion done;
+};
+
+static struct events_waiter * events_waiter_add(int event)
+{
+	struct events_dev * dev = events_dev;
+	struct events_waiter * waiter;
+	DECLARE_BITMAP(mask, EVENTS_MAX_EVENTS);
+
+	if ( ! dev )
+		return ERR_PTR(-ENODEV);
+	if ( event < 0 || event >= dev->num_events )
+		return ERR_PTR(-EINVAL);
+
+	waiter = kzalloc(sizeof(struct events_waiter), GFP_KERNEL);
+	if ( ! waiter )
+		return ERR_PTR(-ENOMEM);
+	init_completion(&waiter->done);
+	waiter->sub.done = &waiter->done;
+	waiter->sub.event = event;
+
+	if (down_interruptible(&dev->sem)) {
+		kfree(waiter);
+		return ERR_PTR(-ERESTARTSYS);
+	}
+	hlist_add_head_rcu(&waiter->sub.node, &dev->subs[event]);
+	events_update_want(dev);
+	bitmap_zero(mask, EVENTS_MAX_EVENTS);
+	set_bit(event, mask);
+	events_arm(dev, mask);
+	up(&dev->sem);
+
+	return waiter;
+}
+
+static long events_waiter_wait(struct events_waiter * waiter, long timeout)
+{
+	return wait_for_completion_interruptible_timeout(&waiter->done, timeout);
+}
+
+static void events_waiter_remove(struct events_waiter * waiter)
+{
+	struct events_dev * dev = events_dev;
+
+	down(&dev->sem);
+	hlist_del_rcu(&waiter->sub.node);
+	events_update_want(dev);
+	up(&dev->sem);
+
+	kfree_rcu(waiter, sub.rcu);
+}
+
+const struct events_waiter_ops events_waiter_ops = {
+	.add = events_waiter_add,
+	.wait = events_waiter_wait,
+	.remove = events_waiter_remove,
+};
+EXPORT_SYMBOL_GPL(events_waiter_ops);
+
+static int events_ioctl_subscribe(struct events_file * pevents_file, struct events_subscription * psub)
+{
+	struct events_dev * dev = pevents_file->dev;
+	DECLARE_BITMAP(mask, EVENTS_MAX_EVENTS);
+	u32 words[EVENTS_MAX_BANKS];
+
+	if ( psub->flags & ~EVENTS_SUBSCRIBE_ALL )
+		return -EINVAL;
+	if ( psub->nbits > dev->num_events )
+		return -EINVAL;
+
+	if (copy_from_user(words, u64_to_user_ptr(psub->mask), BITS_TO_U32(psub->nbits) * sizeof(u32)))
+		return -EFAULT;
+
+	bitmap_zero(mask, EVENTS_MAX_EVENTS);
+	bitmap_from_arr32(mask, words, psub->nbits);
+
+	return events_set_subscription(pevents_file, mask, psub->flags & EVENTS_SUBSCRIBE_ALL);
+}
+
 
 /*
  * open()
@@ -194,16 +774,13 @@ int events_open(struct inode *inode, struct file *filp)
 	struct events_dev *dev = NULL;
 	struct events_file *pevents_file = NULL;
 
-	int success = 0;
 	dev = container_of(inode->i_cdev, struct events_dev, cdev);
 
 	pr_info("iv-events - OPEN (%d)\n", dev->opened);
 
 	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
 
-	disable_irq(dev->irq);
-
-	pevents_file = kmalloc(sizeof(struct events_file), GFP_KERNEL);
+	pevents_file = kzalloc(sizeof(struct events_file), GFP_KERNEL);
 	if (!pevents_file) {
 		err = -ENOMEM;
 		goto out;
@@ -212,23 +789,19 @@ int events_open(struct inode *inode, struct file *filp)
 	init_waitqueue_head( &pevents_file->waitq );
 	pevents_file->dev = dev;
 	pevents_file->all_events = 0;
-	pevents_file->pending = 0;
-	pevents_file->pending_mask = 0;
-	list_add(&pevents_file->list, &dev->filelist);
+	INIT_LIST_HEAD(&pevents_file->efds);
+	spin_lock_init(&pevents_file->queue_lock);
+	INIT_KFIFO(pevents_file->queue);
+	pevents_file->queue_depth = 0;
+	pevents_file->seq = 0;
+	memset(pevents_file->counts, 0, sizeof(pevents_file->counts));
+	pevents_file->overruns = 0;
+	pevents_file->overruns_total = 0;
 	filp->private_data = pevents_file;
 
-	enable_irq(dev->irq);
-
 	dev->opened++;
-	
-	success = 1;
 
 out:
-	if ( ! success ) {
-		if ( pevents_file ) {
-			list_del(&pevents_file->list);
-		}
-	}
 	up(&dev->sem);
 
 	return err;
@@ -242,25 +815,72 @@ int events_release(struct inode *inode, struct file *filp)
 {
 	struct events_file *pevents_file = filp->private_data; 
 	struct events_dev *dev = pevents_file->dev;
+	struct events_sub * sub;
 	int err = 0;
 
 	pr_info("iv-events - RELEASE\n");
 
 	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
 
-	disable_irq(dev->irq);
-	list_del(&pevents_file->list);
-	enable_irq(dev->irq);
-	kfree( pevents_file );
+	bitmap_zero(pevents_file->pending_mask, EVENTS_MAX_EVENTS);
+	events_subscribe(pevents_file, pevents_file->pending_mask);
+	list_for_each_entry(sub, &pevents_file->efds, list)
+		hlist_del_rcu(&sub->node);
+	events_update_want(dev);
 
 	dev->opened--;
 	BUG_ON(dev->opened < 0);
 
 	up(&dev->sem);
+
+	// Wait out any ISR still looking at this file through an old subscription
+	synchronize_rcu();
+	events_free_eventfds(&pevents_file->efds);
+	kfifo_free( &pevents_file->queue );
+	kfree( pevents_file );
 	
 	return err;
 }
 
+/*
+ * Switch a file to queue mode with the given depth, or back to the pending
+ * mask with a depth of 0.  Called with dev->sem held.
+ */
+static int events_set_queue_depth(struct events_file * pevents_file, unsigned long depth)
+{
+	typeof(pevents_file->queue) queue;	// Same record type, so swap() works
+	unsigned long flags;
+	int err;
+
+	if ( depth > EVENTS_MAX_QUEUE_DEPTH )
+		return -EINVAL;
+
+	INIT_KFIFO(queue);
+	if ( depth ) {
+		err = kfifo_alloc(&queue, depth, GFP_KERNEL);
+		if ( err )
+			return err;
+	}
+
+	// Swap in the new queue with the ISR held off
+	spin_lock_irqsave(&pevents_file->queue_lock, flags);
+	swap(pevents_file->queue, queue);
+	pevents_file->queue_depth = depth ? kfifo_size(&pevents_file->queue) : 0;
+	pevents_file->seq = 0;
+	memset(pevents_file->counts, 0, sizeof(pevents_file->counts));
+	pevents_file->overruns = 0;
+	pevents_file->overruns_total = 0;
+	spin_unlock_irqrestore(&pevents_file->queue_lock, flags);
+
+	kfifo_free(&queue);
+
+	// A queue takes every occurrence, so its events stay enabled
+	if ( depth )
+		events_arm(pevents_file->dev, pevents_file->pending_mask);
+
+	return 0;
+}
+
 long events_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int err = 0;
@@ -292,6 +912,39 @@ long events_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		case EVENTS_IOC_R_INSTANCE_COUNT :			
 			__put_user(dev->opened,(unsigned long __user *)arg);					
 			break;		
+		case EVENTS_IOC_W_QUEUE_DEPTH :
+			{
+				unsigned long depth;
+				__get_user(depth, (unsigned long __user *)arg);
+				retval = events_set_queue_depth(pevents_file, depth);
+			}
+			break;
+		case EVENTS_IOC_R_OVERRUNS :
+			__put_user(pevents_file->overruns_total, (unsigned long __user *)arg);
+			break;
+		case EVENTS_IOC_W_SUBSCRIBE :
+			{
+				struct events_subscription sub;
+				if (copy_from_user(&sub, (void __user *)arg, sizeof(sub))) {
+					retval = -EFAULT;
+					break;
+				}
+				retval = events_ioctl_subscribe(pevents_file, &sub);
+			}
+			break;
+		case EVENTS_IOC_W_EVENTFD :
+			{
+				struct events_eventfd efd;
+				if (copy_from_user(&efd, (void __user *)arg, sizeof(efd))) {
+					retval = -EFAULT;
+					break;
+				}
+				retval = events_bind_eventfd(pevents_file, &efd);
+			}
+			break;
+		case EVENTS_IOC_R_NUM_EVENTS :
+			__put_user((unsigned long)dev->num_events, (unsigned long __user *)arg);
+			break;
 		default:  /* redundant, as cmd was checked against MAXNR */
 			retval = -ENOTTY;
 			break;
@@ -301,6 +954,54 @@ long events_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 }
 
+/*
+ * read() in queue mode: block until there is at least one record, then
+ * return as many whole records as fit.  Called with dev->sem held, which
+ * also makes this the queue's only reader.
+ */
+static ssize_t events_read_queue(struct events_file * pevents_file, char __user *buf, size_t count)
+{
+	struct events_dev * dev = pevents_file->dev;
+	struct events_record recs[16];
+	unsigned int copied;
+	unsigned int n;
+	u64 now;
+	int err;
+	int i;
+
+	count -= count % sizeof(struct events_record);
+	if ( count == 0 )
+		return -EINVAL;
+
+	while ( kfifo_is_empty(&pevents_file->queue) ) {
+		up(&dev->sem);
+		err = wait_event_interruptible(
+			pevents_file->waitq, IS_READ_READY(pevents_file)
+			);
+		// The caller releases the sem, so always take it back
+		down(&dev->sem);
+		if (err) return -ERESTARTSYS;
+		if ( ! pevents_file->queue_depth ) return -EAGAIN;
+	}
+
+	// Copy out in chunks, to account the latency of each record
+	copied = 0;
+	while ( copied < count ) {
+		n = kfifo_out(&pevents_file->queue, recs,
+			min_t(size_t, ARRAY_SIZE(recs), ( count - copied ) / sizeof(struct events_record)));
+		if ( n == 0 )
+			break;
+		now = ktime_get_ns();
+		for ( i = 0; i < n; i++ )
+			dev->stats[recs[i].event].user[events_lat_bucket(now - recs[i].timestamp)]++;
+		if (copy_to_user(buf + copied, recs, n * sizeof(struct events_record)))
+			return -EFAULT;
+		copied += n * sizeof(struct events_record);
+	}
+
+	return copied;
+}
+
 /*
  * read()
  */
@@ -310,19 +1011,29 @@ ssize_t events_read(struct file *filp, char __user *buf, size_t count,
 	struct events_file * pevents_file = filp->private_data; 
 	struct events_dev * dev = pevents_file->dev;
 	ssize_t retval = 0;
-	u32 events;
+	DECLARE_BITMAP(events, EVENTS_MAX_EVENTS);
+	u32 words[EVENTS_MAX_BANKS];
+	u64 now;
+	int nbits;
 	int err;
 	int i;
 
 	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
 
+	if ( pevents_file->queue_depth ) {
+		retval = events_read_queue(pevents_file, buf, count);
+		goto out;
+	}
+
 	//
 	// Verify count/buf is word aligned, and at least a word big.
 	//
-	if ( count != sizeof(u32) ) {
+	if ( count < sizeof(u32) || count % sizeof(u32) ) {
 		retval = -EFAULT;
 		goto out;
 	}
+	nbits = min_t(int, count * 8, dev->num_events);
+	count = BITS_TO_U32(nbits) * sizeof(u32);
 
 	//
 	// Block until pending bits set, then clear them.  
@@ -331,7 +1042,7 @@ ssize_t events_read(struct file *filp, char __user *buf, size_t count,
 	// clear them.  We have to be careful, though to clear them atomically,
 	// because we can be resetting them in the ISR.  We don't have to do
 	// the whole thing atomically, because we're only clearing the bits
-	// we're send back to the user.
+	// we're send back to the user.  Each bit is cleared atomically, though.
 	//
 	up(&dev->sem);
 	err = wait_event_interruptible(
@@ -340,14 +1051,18 @@ ssize_t events_read(struct file *filp, char __user *buf, size_t count,
 	if (err) return -ERESTARTSYS;
 	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
 
-	events = pevents_file->pending & pevents_file->pending_mask;
-	for (i = 0; i < 32; i++) {
-		if ( events & ( 1 << i )) {
-			pevents_file->pending &= ~(1 << i);
-		}
+	bitmap_and(events, pevents_file->pending, pevents_file->pending_mask, nbits);
+	now = ktime_get_ns();
+	for_each_set_bit(i, events, nbits) {
+		dev->stats[i].user[events_lat_bucket(now - pevents_file->pending_ts[i])]++;
+		clear_bit(i, pevents_file->pending);
 	}
 
-	if (copy_to_user(buf, &events, count)) {
+	// We can take these again
+	events_arm(dev, events);
+
+	bitmap_to_arr32(words, events, nbits);
+	if (copy_to_user(buf, words, count)) {
 		retval = -EFAULT;
 		goto out;
 	}
@@ -365,7 +1080,8 @@ out:
  *
  * A write consists of a u32 that is the bitmask of events to wait for.  The
  * high bit is special (and means we can really only use 31 events) - it
- * indicates, if set, to wait for all events, instead of any event.
+ * indicates, if set, to wait for all events, instead of any event.  Use
+ * EVENTS_IOC_W_SUBSCRIBE for the others.
  */
 ssize_t events_write(struct file *filp, const char __user *buf, size_t count,
 				loff_t *f_pos)
@@ -374,6 +1090,9 @@ ssize_t events_write(struct file *filp, const char __user *buf, size_t count,
 	struct events_dev * dev = pevents_file->dev;
 	ssize_t retval = 0;
 	u32 pending_mask;
+	u32 all_events;
+	DECLARE_BITMAP(mask, EVENTS_MAX_EVENTS);
+	int err;
 
 	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
 
@@ -386,11 +1105,16 @@ ssize_t events_write(struct file *filp, const char __user *buf, size_t count,
 		retval = -EFAULT;
 		goto out;
 	}
-	pevents_file->all_events = pending_mask & 0x80000000;
-	pevents_file->pending_mask = pending_mask & ( ~ 0x80000000 );
-
-  	// allow these events to cause interrupts
-	dev->vsoc_mem[EVENTS_MASK_EN_REG] = pending_mask;
+	all_events = pending_mask & 0x80000000;
+	pending_mask &= ~ 0x80000000;
+
+	bitmap_zero(mask, EVENTS_MAX_EVENTS);
+	bitmap_from_arr32(mask, &pending_mask, 32);
+	err = events_set_subscription(pevents_file, mask, all_events);
+	if ( err ) {
+		retval = err;
+		goto out;
+	}
 
 	retval = count;
 out:
@@ -405,7 +1129,7 @@ unsigned int events_poll(struct file *filp, poll_table *wait)
 	unsigned int mask = 0;
 
 	poll_wait(filp, &pevents_file->waitq, wait);
-	if ( ARE_REQUESTED_EVENTS_PENDING(pevents_file)) {
+	if ( IS_READ_READY(pevents_file)) {
 		mask |= POLLIN | POLLRDNORM;
 	}
 
@@ -435,6 +1159,10 @@ static int events_remove(struct platform_device *pdev)
 
 	/* Get rid of our char dev entries */
 	if (events_dev) {
+		if ( events_dev->lg_timer.function ) {
+			hrtimer_cancel(&events_dev->lg_timer);
+		}
+
 		if ( events_dev->irq) {
 			free_irq(events_dev->irq, events_dev);
 		}
@@ -451,6 +1179,7 @@ static int events_remove(struct platform_device *pdev)
 		class_destroy( events_dev->class );
 		cdev_del(&events_dev->cdev);
 		unregister_chrdev_region(events_dev_num, 1);
+		kfree(events_dev->stats);
 		kfree(events_dev);
 		events_dev = NULL;
 	}
@@ -459,26 +1188,31 @@ static int events_remove(struct platform_device *pdev)
 }
 
 
-static int levels_get(void *data, u64 *val)
+/*
+ * Pending register of each bank, one line per bank
+ */
+static int levels_show(struct seq_file *s, void *unused)
 {
-	struct events_dev *dev = (struct events_dev *)data;
+	struct events_dev *dev = (struct events_dev *)s->private;
+	int bank;
 
-	*val = (u64)events_get_events(dev);
+	for ( bank = 0; bank < dev->num_banks; bank++ )
+		seq_printf(s, "%d: 0x%08x\n", bank, events_get_events(dev, bank));
 
 	return 0;
 }
-DEFINE_SIMPLE_ATTRIBUTE(levels_fops, levels_get, NULL, "0x%08llx\n");
+DEFINE_SHOW_ATTRIBUTE(levels);
 
 static int trigger_set(void *data, u64 val)
 {
 	struct events_dev *dev = (struct events_dev *)data;
-	u32 mask = (u32)val;
+	u64 timestamp = ktime_get_ns();
 	int i;
 
-	for ( i = 0; i < 31; i++ ) {
-		if ( mask & 1 )
-			events_wake_up(dev, i);
-		mask >>= 1;
+	for ( i = 0; i < min(64, dev->num_events); i++ ) {
+		if ( val & 1 )
+			events_wake_up(dev, i, timestamp);
+		val >>= 1;
 	}
 
 	return 0;
@@ -504,10 +1238,265 @@ static int scratch_set(void *data, u64 val)
 }
 DEFINE_SIMPLE_ATTRIBUTE(scratch_fops, scratch_get, scratch_set, "0x%08llx\n");
 
+static int masked_show(struct seq_file *s, void *unused)
+{
+	struct events_dev *dev = (struct events_dev *)s->private;
+	int i;
+
+	for ( i = 0; i < dev->num_events; i++ ) {
+		if ( dev->masked_counts[i] )
+			seq_printf(s, "%d: %u\n", i, dev->masked_counts[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(masked);
+
+static int counts_show(struct seq_file *s, void *unused)
+{
+	struct events_dev *dev = (struct events_dev *)s->private;
+	int i;
+
+	for ( i = 0; i < dev->num_events; i++ ) {
+		if ( dev->stats[i].count )
+			seq_printf(s, "%d: %u\n", i, dev->stats[i].count);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(counts);
+
+static void latency_show_hist(struct seq_file *s, const char * name, u32 * hist)
+{
+	int i;
+
+	seq_printf(s, "  %-8s", name);
+	for ( i = 0; i < EVENTS_LAT_BUCKETS; i++ )
+		seq_printf(s, " %u", hist[i]);
+	seq_puts(s, "\n");
+}
+
+/*
+ * Per-event latency histograms, one column per log2(ns) bucket
+ */
+static int latency_show(struct seq_file *s, void *unused)
+{
+	struct events_dev *dev = (struct events_dev *)s->private;
+	int i;
+
+	for ( i = 0; i < dev->num_events; i++ ) {
+		if ( ! dev->stats[i].count )
+			continue;
+		seq_printf(s, "%d: count %u\n", i, dev->stats[i].count);
+		latency_show_hist(s, "dispatch", dev->stats[i].dispatch);
+		latency_show_hist(s, "user", dev->stats[i].user);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+static int stats_reset_set(void *data, u64 val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+
+	memset(dev->stats, 0, dev->num_events * sizeof(struct events_stats));
+	memset(dev->masked_counts, 0, sizeof(dev->masked_counts));
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(stats_reset_fops, NULL, stats_reset_set, "%llu\n");
+
+static int lg_sequence_show(struct seq_file *s, void *unused)
+{
+	struct events_dev *dev = (struct events_dev *)s->private;
+	int i;
+
+	for ( i = 0; i < dev->lg_len; i++ )
+		seq_printf(s, "0x%llx %llu\n", dev->lg_steps[i].mask, dev->lg_steps[i].delay_ns);
+
+	return 0;
+}
+
+static int lg_sequence_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lg_sequence_show, inode->i_private);
+}
+
+static ssize_t lg_sequence_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct events_dev *dev = ((struct seq_file *)file->private_data)->private;
+	struct events_lg_step *steps;
+	char *buf, *p, *line;
+	int n = 0;
+	int err = 0;
+
+	if ( count > EVENTS_LG_MAX_STEPS * 64 )
+		return -E2BIG;
+
+	buf = memdup_user_nul(ubuf, count);
+	if ( IS_ERR(buf) )
+		return PTR_ERR(buf);
+
+	steps = kcalloc(EVENTS_LG_MAX_STEPS, sizeof(struct events_lg_step), GFP_KERNEL);
+	if ( ! steps ) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	p = buf;
+	while (( line = strsep(&p, "\n")) != NULL ) {
+		line = strim(line);
+		if ( ! *line )
+			continue;
+		if ( n == EVENTS_LG_MAX_STEPS ) {
+			err = -E2BIG;
+			goto out;
+		}
+		if ( sscanf(line, "%llx %llu", &steps[n].mask, &steps[n].delay_ns) < 1 ) {
+			err = -EINVAL;
+			goto out;
+		}
+		if ( steps[n].delay_ns && steps[n].delay_ns < EVENTS_LG_MIN_NS ) {
+			err = -EINVAL;
+			goto out;
+		}
+		n++;
+	}
+
+	if (down_interruptible(&dev->sem)) {
+		err = -ERESTARTSYS;
+		goto out;
+	}
+	if ( dev->lg_running ) {
+		err = -EBUSY;
+	} else {
+		memcpy(dev->lg_steps, steps, n * sizeof(struct events_lg_step));
+		dev->lg_len = n;
+	}
+	up(&dev->sem);
+
+out:
+	kfree(steps);
+	kfree(buf);
+	return err ? err : count;
+}
+
+static const struct file_operations lg_sequence_fops = {
+	.owner = THIS_MODULE,
+	.open = lg_sequence_open,
+	.read = seq_read,
+	.write = lg_sequence_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int lg_period_get(void *data, u64 *val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+
+	*val = dev->lg_period_ns;
+
+	return 0;
+}
+
+static int lg_period_set(void *data, u64 val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+	int err = 0;
+
+	if ( val < EVENTS_LG_MIN_NS )
+		return -EINVAL;
+
+	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
+	if ( dev->lg_running )
+		err = -EBUSY;
+	else
+		dev->lg_period_ns = val;
+	up(&dev->sem);
+
+	return err;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lg_period_fops, lg_period_get, lg_period_set, "%llu\n");
+
+static int lg_passes_get(void *data, u64 *val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+
+	*val = dev->lg_passes;
+
+	return 0;
+}
+
+static int lg_passes_set(void *data, u64 val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+	int err = 0;
+
+	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
+	if ( dev->lg_running )
+		err = -EBUSY;
+	else
+		dev->lg_passes = val;
+	up(&dev->sem);
+
+	return err;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lg_passes_fops, lg_passes_get, lg_passes_set, "%llu\n");
+
+static int lg_enable_get(void *data, u64 *val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+
+	*val = dev->lg_running;
+
+	return 0;
+}
+
+static int lg_enable_set(void *data, u64 val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+	int err = 0;
+
+	if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
+
+	hrtimer_cancel(&dev->lg_timer);
+	dev->lg_running = false;
+
+	if ( val ) {
+		if ( dev->lg_len == 0 ) {
+			err = -EINVAL;
+		} else {
+			dev->lg_pos = 0;
+			dev->lg_pass = 0;
+			dev->lg_injected = 0;
+			dev->lg_running = true;
+			hrtimer_start(&dev->lg_timer, 0, HRTIMER_MODE_REL);
+		}
+	}
+
+	up(&dev->sem);
+
+	return err;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lg_enable_fops, lg_enable_get, lg_enable_set, "%llu\n");
+
+static int lg_injected_get(void *data, u64 *val)
+{
+	struct events_dev *dev = (struct events_dev *)data;
+
+	*val = dev->lg_injected;
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lg_injected_fops, lg_injected_get, NULL, "%llu\n");
+
 static int events_probe(struct platform_device *pdev)
 {
 	int err;
+	int i;
 	struct dentry *dbg_dentry;
+	struct dentry *lg_dentry;
 
 	pr_info("iv-events - PROBE\n");
 
@@ -545,7 +1534,8 @@ static int events_probe(struct platform_device *pdev)
 		goto fail;
 	}
 
-	INIT_LIST_HEAD(&events_dev->filelist);
+	for ( i = 0; i < EVENTS_MAX_EVENTS; i++ )
+		INIT_HLIST_HEAD(&events_dev->subs[i]);
 	events_dev->opened = 0;
 
 	err = of_property_read_u32(pdev->dev.of_node, "irq", &events_dev->hw_irq);
@@ -566,14 +1556,35 @@ static int events_probe(struct platform_device *pdev)
 	}
 	dev_info(&pdev->dev, "pl reg base: 0x%x, sz 0x%x\n", events_dev->reg_base, events_dev->reg_sz); 
 
+	if ( of_property_read_u32(pdev->dev.of_node, "num-banks", &events_dev->num_banks) != 0 )
+		events_dev->num_banks = 1;
+	if ( events_dev->num_banks < 1 || events_dev->num_banks > EVENTS_MAX_BANKS
+		|| events_dev->num_banks * EVENTS_BANK_STRIDE * sizeof(u32) > events_dev->reg_sz ) {
+		dev_err(&pdev->dev, "invalid num-banks %u\n", events_dev->num_banks);
+		err = -EINVAL;
+		goto fail;
+	}
+	events_dev->num_events = events_dev->num_banks * 32;
+	dev_info(&pdev->dev, "%d events\n", events_dev->num_events);
+
+	events_dev->stats = kcalloc(events_dev->num_events, sizeof(struct events_stats), GFP_KERNEL);
+	if ( ! events_dev->stats ) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
 	events_dev->vsoc_mem = (unsigned int *)ioremap( events_dev->reg_base, events_dev->reg_sz );
 	if ( events_dev->vsoc_mem == NULL ) {
 		err = -ENOMEM;
 		goto fail;
 	}
 
-	//  clear any pending events
-	events_dev->vsoc_mem[EVENTS_PENDING_REG] = 0xFFFFFFFF;
+	//  clear any pending events, and start with them all masked
+	spin_lock_init(&events_dev->hw_lock);
+	for ( i = 0; i < events_dev->num_banks; i++ ) {
+		EVENTS_REG(events_dev, i, EVENTS_MASK_REG) = 0x00000000;
+		EVENTS_REG(events_dev, i, EVENTS_PENDING_REG) = 0xFFFFFFFF;
+	}
 
 	dbg_dentry = debugfs_create_dir(MODNAME, 0);
 	if (!dbg_dentry) {
@@ -604,8 +1615,56 @@ static int events_probe(struct platform_device *pdev)
 		goto fail;
 	}
 
+	dbg_dentry = debugfs_create_file( "masked", 0444, events_dev->dbg_dentry, events_dev, &masked_fops);
+	if (!dbg_dentry) {
+    		dev_err(&pdev->dev, "failed to create debugfs file\n");
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	dbg_dentry = debugfs_create_file( "counts", 0444, events_dev->dbg_dentry, events_dev, &counts_fops);
+	if (!dbg_dentry) {
+    		dev_err(&pdev->dev, "failed to create debugfs file\n");
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	dbg_dentry = debugfs_create_file( "latency", 0444, events_dev->dbg_dentry, events_dev, &latency_fops);
+	if (!dbg_dentry) {
+    		dev_err(&pdev->dev, "failed to create debugfs file\n");
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	dbg_dentry = debugfs_create_file( "stats_reset", 0222, events_dev->dbg_dentry, events_dev, &stats_reset_fops);
+	if (!dbg_dentry) {
+    		dev_err(&pdev->dev, "failed to create debugfs file\n");
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	hrtimer_init(&events_dev->lg_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	events_dev->lg_timer.function = events_lg_timer;
+	events_dev->lg_period_ns = 1000000;
+
+	lg_dentry = debugfs_create_dir("loadgen", events_dev->dbg_dentry);
+	if (!lg_dentry) {
+    		dev_err(&pdev->dev, "failed to create debugfs dir\n");
+		err = -ENOMEM;
+		goto fail;
+	}	
+	if (!debugfs_create_file( "sequence", 0644, lg_dentry, events_dev, &lg_sequence_fops)
+		|| !debugfs_create_file( "period_ns", 0644, lg_dentry, events_dev, &lg_period_fops)
+		|| !debugfs_create_file( "passes", 0644, lg_dentry, events_dev, &lg_passes_fops)
+		|| !debugfs_create_file( "enable", 0644, lg_dentry, events_dev, &lg_enable_fops)
+		|| !debugfs_create_file( "injected", 0444, lg_dentry, events_dev, &lg_injected_fops)) {
+    		dev_err(&pdev->dev, "failed to create debugfs file\n");
+		err = -ENOMEM;
+		goto fail;
+	}
+
 	events_dev->irq = xlate_irq(events_dev->hw_irq);
-	err = request_irq(events_dev->irq, (irq_handler_t)events_isr, 0, MODNAME, events_dev);
+	err = request_threaded_irq(events_dev->irq, events_isr, events_isr_thread, 0, MODNAME, events_dev);
 	if ( err ) goto fail;
 
 	return 0;
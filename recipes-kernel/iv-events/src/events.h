@@ -3,6 +3,27 @@
 
 #include "_events.h"
 
-#define MODNAME "events"
+/*
+ * In-kernel waiters, for other drivers to sleep until an event fires.  Get
+ * the ops with symbol_get(events_waiter_ops), so they don't depend on this
+ * module being loaded.
+ *
+ * add() subscribes to the event and enables it.  wait() returns as for
+ * wait_for_completion_interruptible_timeout(), once per occurrence since
+ * add(), so check the condition being waited for after add() and after each
+ * wait().
+ *
+ * Other modules' recipes fetch this header (and _events.h) from here, as
+ * kernel-module-iv-ocp.bb does.
+ */
+struct events_waiter;
+
+struct events_waiter_ops {
+	struct events_waiter * (*add)(int event);
+	long (*wait)(struct events_waiter * waiter, long timeout);
+	void (*remove)(struct events_waiter * waiter);
+};
+
+extern const struct events_waiter_ops events_waiter_ops;
 
 #endif
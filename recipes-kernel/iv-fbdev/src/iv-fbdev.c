@@ -6,6 +6,27 @@
  * This file is subject to the terms and conditions of the GNU General Public
  * License.  See the file COPYING in the main directory of this archive
  * for more details.
+ *
+ * Device tree:
+ *
+ *	resolution	<width height bpp>, bpp 16 (RGB565), 24 (RGB888) or
+ *			32 (XRGB8888).
+ *	memory-region	optional, a no-map reserved-memory node to use as
+ *			video memory.
+ *	reg		video memory (unless memory-region is given), then
+ *			optionally the scan-out control registers (needed for
+ *			panning).  Only what the frames need is mapped.
+ *	interrupts	optional, the scan-out vsync interrupt (needed for
+ *			FBIO_WAITFORVSYNC).
+ *	num-buffers	optional, frames in video memory, 1 (default) to
+ *			IV_MAX_BUFFERS.  yres_virtual is yres * num-buffers,
+ *			and an application flips between them by panning
+ *			yoffset, with zero copies.
+ *
+ * With the shadow parameter set, drawing (console, read()/write() and
+ * mmap()) goes to a cacheable copy of the video memory instead, and the
+ * parts of it that changed are copied to the video memory every
+ * shadow_flush_ms, or before a pan.
  */
 
 #include <linux/module.h>
@@ -15,8 +36,15 @@
 #include <linux/of.h>
 #include <linux/of_address.h>
 #include <linux/of_platform.h>
+#include <linux/of_reserved_mem.h>
 #include <linux/platform_device.h>
 #include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/wait.h>
+#include <linux/io.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/mm.h>
 
 #include <linux/fb.h>
 #include <linux/init.h>
@@ -29,77 +57,254 @@
  *********************************************************************/
 
 #define MODNAME "ivfbdev"
-#define IV_SCREEN_WIDTH (1024)
-#define IV_SCREEN_HEIGHT (768)
-#define IV_BYTES_PER_PIXEL (2)
-#define ANDROID_BYTES_PER_PIXEL 2
-#if 0
-#if defined(CONFIG_MACH_IV_ATLAS_I_Z7E)
-    #define VIDEOMEMSTART	(0x1F000000)
-    #define VIDEOMEMFINISH	(0x1FFFFFFF)
-#elif defined(CONFIG_ARCH_IV_ATLAS_II_Z8)
-    #define VIDEOMEMSTART	(0x7F000000)
-    #define VIDEOMEMFINISH	(0x7FFFFFFF)
-#else  //OZZY
-    #define VIDEOMEMSTART	(0x7F000000)
-    #define VIDEOMEMFINISH	(0x7FFFFFFF)
-#endif
-#else
-    #define VIDEOMEMSTART	(0x7F000000)
-    #define VIDEOMEMFINISH	(0x7FFFFFFF)
-#endif
-
-//#define VIDEOMEMSIZE	(IV_BYTES_PER_PIXEL*IV_SCREEN_WIDTH*IV_SCREEN_HEIGHT)
-#define VIDEOMEMSIZE   VIDEOMEMFINISH-VIDEOMEMSTART
+#define IV_MAX_WIDTH    4096
+#define IV_MAX_HEIGHT   4096
+#define IV_MAX_BUFFERS  3
+
+/*
+ * Scan-out control registers
+ */
+#define IVFB_REG_SCANOUT_BASE   0x00    // Physical address of the first line, latched at vsync
+#define IVFB_REG_IRQ_STATUS     0x04    // Write 1 to clear
+#define IVFB_IRQ_VSYNC          (1 << 0)
 
 static void * fb_addr = NULL;
 
-static struct fb_var_screeninfo iveia_fb_default = {
-	.xres           = IV_SCREEN_WIDTH,
-	.yres           = IV_SCREEN_HEIGHT,
-	.xres_virtual   = IV_SCREEN_WIDTH,
-	.yres_virtual   = IV_SCREEN_HEIGHT,
-	.bits_per_pixel = IV_BYTES_PER_PIXEL * 8,
-//    .transp.offset  = 0,
-//    .transp.length  = 8,
-#if 0
-    .blue.offset    = 11,
-    .blue.length    = 5,
-    .green.offset   = 5,
-    .green.length   = 6,
-    .red.offset     = 0,
-    .red.length     = 5,
-#else
-    .blue.offset    = 0,
-    .blue.length    = 5,
-    .green.offset   = 5,
-    .green.length   = 6,
-    .red.offset     = 11,
-    .red.length     = 5,
-#endif
-};
+static bool shadow = false;
+module_param(shadow, bool, 0444);
+MODULE_PARM_DESC(shadow, "Draw into a cacheable shadow buffer, flushed to video memory with deferred I/O");
+
+static unsigned int shadow_flush_ms = 20;
+module_param(shadow_flush_ms, uint, 0444);
+MODULE_PARM_DESC(shadow_flush_ms, "Time between shadow buffer flushes, in ms");
 
 static struct fb_fix_screeninfo iveia_fb_fix = {
 	.id             = "iVeia HH1 FB",
 	.type           = FB_TYPE_PACKED_PIXELS,
 	.visual         = FB_VISUAL_TRUECOLOR,
-    .line_length    = IV_SCREEN_WIDTH * IV_BYTES_PER_PIXEL,
-	.smem_start     = VIDEOMEMSTART,
-	.smem_len       = VIDEOMEMSIZE,
-};
-
-static struct fb_ops iveia_fb_ops = {
-	.fb_read        = fb_sys_read,
-	.fb_write       = fb_sys_write,
-	.fb_fillrect	= sys_fillrect,
-	.fb_copyarea	= sys_copyarea,
-	.fb_imageblit	= sys_imageblit,
 };
 
 static u32 pseudo_palette[17] = {0};  // required by sys_imageblit (only used for fb console)
 
 struct iveia_fb_par {
-    unsigned long * misc_reg;
+	void __iomem * misc_reg;        // Scan-out control registers, if any
+	int irq;
+
+	wait_queue_head_t vsync_wait;
+	unsigned int vsync_count;
+
+	// Shadow mode
+	void * shadow;
+	struct fb_deferred_io defio;
+	spinlock_t dirty_lock;
+	u32 dirty_x1, dirty_y1;         // Dirty rectangle, empty if x1 >= x2
+	u32 dirty_x2, dirty_y2;
+};
+
+/*********************************************************************
+ *
+ * Shadow buffer
+ *
+ *********************************************************************/
+
+/*
+ * Add a rectangle drawn by the kernel to the dirty one, and have it flushed.
+ */
+static void iveia_fb_dirty(struct fb_info * info, u32 x, u32 y, u32 width, u32 height)
+{
+	struct iveia_fb_par * par = info->par;
+	u32 x2 = min(x + width, info->var.xres_virtual);
+	u32 y2 = min(y + height, info->var.yres_virtual);
+	unsigned long flags;
+
+	if ( ! par->shadow || x >= x2 || y >= y2 )
+		return;
+
+	spin_lock_irqsave(&par->dirty_lock, flags);
+	if ( par->dirty_x1 >= par->dirty_x2 ) {
+		par->dirty_x1 = x;
+		par->dirty_y1 = y;
+		par->dirty_x2 = x2;
+		par->dirty_y2 = y2;
+	} else {
+		par->dirty_x1 = min(par->dirty_x1, x);
+		par->dirty_y1 = min(par->dirty_y1, y);
+		par->dirty_x2 = max(par->dirty_x2, x2);
+		par->dirty_y2 = max(par->dirty_y2, y2);
+	}
+	spin_unlock_irqrestore(&par->dirty_lock, flags);
+
+	schedule_delayed_work(&info->deferred_work, info->fbdefio->delay);
+}
+
+/*
+ * Deferred I/O: copy the dirty rectangle, and each page written through
+ * mmap(), to video memory.  Full width rows go in one burst.
+ */
+static void iveia_fb_deferred_io(struct fb_info * info, struct list_head * pagelist)
+{
+	struct iveia_fb_par * par = info->par;
+	u32 line_length = info->fix.line_length;
+	u32 bytes_pp = info->var.bits_per_pixel / 8;
+	u32 x1, y1, x2, y2, y;
+	unsigned long flags;
+	unsigned long offset, len;
+	struct page * page;
+
+	spin_lock_irqsave(&par->dirty_lock, flags);
+	x1 = par->dirty_x1;
+	y1 = par->dirty_y1;
+	x2 = par->dirty_x2;
+	y2 = par->dirty_y2;
+	par->dirty_x1 = par->dirty_x2 = 0;
+	spin_unlock_irqrestore(&par->dirty_lock, flags);
+
+	if ( x1 < x2 ) {
+		if ( x1 == 0 && x2 == info->var.xres_virtual ) {
+			memcpy_toio(fb_addr + y1 * line_length, par->shadow + y1 * line_length,
+				(y2 - y1) * line_length);
+		} else {
+			for ( y = y1; y < y2; y++ )
+				memcpy_toio(fb_addr + y * line_length + x1 * bytes_pp,
+					par->shadow + y * line_length + x1 * bytes_pp,
+					(x2 - x1) * bytes_pp);
+		}
+	}
+
+	list_for_each_entry(page, pagelist, lru) {
+		offset = page->index << PAGE_SHIFT;
+		if ( offset >= info->fix.smem_len )
+			continue;
+		len = min_t(unsigned long, PAGE_SIZE, info->fix.smem_len - offset);
+		memcpy_toio(fb_addr + offset, par->shadow + offset, len);
+	}
+}
+
+static void iveia_fb_fillrect(struct fb_info * info, const struct fb_fillrect * rect)
+{
+	sys_fillrect(info, rect);
+	iveia_fb_dirty(info, rect->dx, rect->dy, rect->width, rect->height);
+}
+
+static void iveia_fb_copyarea(struct fb_info * info, const struct fb_copyarea * area)
+{
+	sys_copyarea(info, area);
+	iveia_fb_dirty(info, area->dx, area->dy, area->width, area->height);
+}
+
+static void iveia_fb_imageblit(struct fb_info * info, const struct fb_image * image)
+{
+	sys_imageblit(info, image);
+	iveia_fb_dirty(info, image->dx, image->dy, image->width, image->height);
+}
+
+static ssize_t iveia_fb_write(struct fb_info * info, const char __user * buf, size_t count, loff_t * ppos)
+{
+	u32 line_length = info->fix.line_length;
+	ssize_t ret;
+	u32 y1, y2;
+
+	ret = fb_sys_write(info, buf, count, ppos);
+	if ( ret > 0 ) {
+		y1 = (*ppos - ret) / line_length;
+		y2 = DIV_ROUND_UP(*ppos, line_length);
+		iveia_fb_dirty(info, 0, y1, info->var.xres_virtual, y2 - y1);
+	}
+
+	return ret;
+}
+
+/*********************************************************************
+ *
+ * Panning and vsync
+ *
+ *********************************************************************/
+
+static irqreturn_t iveia_fb_isr(int irq, void * dev_id)
+{
+	struct iveia_fb_par * par = dev_id;
+	u32 status;
+
+	status = ioread32(par->misc_reg + IVFB_REG_IRQ_STATUS);
+	if ( ! ( status & IVFB_IRQ_VSYNC ))
+		return IRQ_NONE;
+	iowrite32(IVFB_IRQ_VSYNC, par->misc_reg + IVFB_REG_IRQ_STATUS);
+
+	par->vsync_count++;
+	wake_up_all(&par->vsync_wait);
+
+	return IRQ_HANDLED;
+}
+
+static int iveia_fb_wait_for_vsync(struct fb_info * info)
+{
+	struct iveia_fb_par * par = info->par;
+	unsigned int count = READ_ONCE(par->vsync_count);
+	long ret;
+
+	if ( par->irq <= 0 )
+		return -ENODEV;
+
+	ret = wait_event_interruptible_timeout(par->vsync_wait,
+			READ_ONCE(par->vsync_count) != count, msecs_to_jiffies(100));
+	if ( ret < 0 )
+		return ret;
+	if ( ret == 0 )
+		return -ETIMEDOUT;
+
+	return 0;
+}
+
+/*
+ * Point the scan-out at the frame starting at yoffset.  It is latched at the
+ * next vsync; FB_ACTIVATE_VBL waits for it, otherwise the application must
+ * FBIO_WAITFORVSYNC before drawing into the frame it flipped away from.
+ */
+static int iveia_fb_pan_display(struct fb_var_screeninfo * var, struct fb_info * info)
+{
+	struct iveia_fb_par * par = info->par;
+
+	if ( ! par->misc_reg )
+		return var->yoffset ? -EINVAL : 0;
+
+	// The frame being flipped to must be complete in video memory
+	if ( par->shadow )
+		flush_delayed_work(&info->deferred_work);
+
+	iowrite32(info->fix.smem_start + var->yoffset * info->fix.line_length,
+		par->misc_reg + IVFB_REG_SCANOUT_BASE);
+
+	if ( var->activate & FB_ACTIVATE_VBL )
+		return iveia_fb_wait_for_vsync(info);
+
+	return 0;
+}
+
+static int iveia_fb_ioctl(struct fb_info * info, unsigned int cmd, unsigned long arg)
+{
+	u32 crtc;
+
+	switch ( cmd ) {
+		case FBIO_WAITFORVSYNC:
+			if ( get_user(crtc, (u32 __user *) arg) )
+				return -EFAULT;
+			if ( crtc != 0 )
+				return -ENODEV;
+			return iveia_fb_wait_for_vsync(info);
+
+		default:
+			return -ENOTTY;
+	}
+}
+
+static struct fb_ops iveia_fb_ops = {
+	.fb_read        = fb_sys_read,
+	.fb_write       = iveia_fb_write,
+	.fb_fillrect	= iveia_fb_fillrect,
+	.fb_copyarea	= iveia_fb_copyarea,
+	.fb_imageblit	= iveia_fb_imageblit,
+	.fb_pan_display = iveia_fb_pan_display,
+	.fb_ioctl       = iveia_fb_ioctl,
 };
 
 /*********************************************************************
@@ -108,27 +313,52 @@ struct iveia_fb_par {
  *
  *********************************************************************/
 
+static int iveia_fb_set_format(struct fb_var_screeninfo * var, u32 bpp)
+{
+	var->bits_per_pixel = bpp;
+
+	switch ( bpp ) {
+		case 16:
+			var->red.offset = 11;
+			var->red.length = 5;
+			var->green.offset = 5;
+			var->green.length = 6;
+			var->blue.offset = 0;
+			var->blue.length = 5;
+			break;
+
+		case 24:
+		case 32:
+			var->red.offset = 16;
+			var->red.length = 8;
+			var->green.offset = 8;
+			var->green.length = 8;
+			var->blue.offset = 0;
+			var->blue.length = 8;
+			break;
+
+		default:
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int iveia_fb_probe(struct platform_device *dev)
 {
 	struct fb_info * info = NULL;
     struct iveia_fb_par * par = NULL;
+	struct resource * res;
+	u32 num_buffers = 1;
+	unsigned long size;
 	int ret, i;
 
-    u64 dt_reg[2];
     u32 dt_resolution[3];
-
-    for ( i = 0; i < sizeof(dt_reg)/sizeof(dt_reg[0]); i++ )
-    {
-        ret = of_property_read_u64_index( dev->dev.of_node, 
-                           "reg", i, &dt_reg[i] );
-        if (ret)
-        {
-            printk(KERN_ERR "ivfbdev: dt ERR: reg property\n");
-            goto out;
-        }
-    }
-    printk(KERN_ERR "ivfbdev: dt reg: 0x%llx 0x%llx\n", 
-            dt_reg[0], dt_reg[1]);
+	struct device_node * np;
+	struct reserved_mem * rmem;
+	phys_addr_t mem_start;
+	resource_size_t mem_size;
+	int ctrl_index;
 
     for ( i = 0; i < sizeof(dt_resolution)/sizeof(dt_resolution[0]); i++ )
     {
@@ -140,32 +370,152 @@ static int iveia_fb_probe(struct platform_device *dev)
             goto out;
         }
     }
-    printk(KERN_ERR "ivfbdev: dt resolution: %u x %u, %u bpp\n", 
+    printk(KERN_INFO "ivfbdev: dt resolution: %u x %u, %u bpp\n", 
             dt_resolution[0], dt_resolution[1], dt_resolution[2]);
 
+	if ( dt_resolution[0] == 0 || dt_resolution[0] > IV_MAX_WIDTH
+		|| dt_resolution[1] == 0 || dt_resolution[1] > IV_MAX_HEIGHT )
+	{
+		printk(KERN_ERR "ivfbdev: dt ERR: resolution %u x %u\n", dt_resolution[0], dt_resolution[1]);
+		ret = -EINVAL;
+		goto out;
+	}
 
-    fb_addr = ioremap(iveia_fb_fix.smem_start, iveia_fb_fix.smem_len);
-	if ( ! fb_addr ) return -ENOMEM;
+	/*
+	 * Video memory: a reserved-memory region, or the first reg.  The scan-out
+	 * control registers are the reg after it, if any.
+	 */
+	np = of_parse_phandle(dev->dev.of_node, "memory-region", 0);
+	if ( np ) {
+		rmem = of_reserved_mem_lookup(np);
+		of_node_put(np);
+		if ( ! rmem ) {
+			printk(KERN_ERR "ivfbdev: dt ERR: memory-region\n");
+			ret = -EINVAL;
+			goto out;
+		}
+		mem_start = rmem->base;
+		mem_size = rmem->size;
+		ctrl_index = 0;
+	} else {
+		res = platform_get_resource(dev, IORESOURCE_MEM, 0);
+		if ( ! res ) {
+			printk(KERN_ERR "ivfbdev: dt ERR: reg property\n");
+			ret = -EINVAL;
+			goto out;
+		}
+		mem_start = res->start;
+		mem_size = resource_size(res);
+		ctrl_index = 1;
+	}
+    printk(KERN_INFO "ivfbdev: video memory: %pa, size %pa\n", &mem_start, &mem_size);
 
-    /*
-     * Don't erase the screen - u-boot already put up a splash screen.
-     */
-    if (0) {
-        memset(fb_addr, 0, iveia_fb_fix.smem_len);
-    }
+	of_property_read_u32(dev->dev.of_node, "num-buffers", &num_buffers);
+	if ( num_buffers < 1 || num_buffers > IV_MAX_BUFFERS ) {
+		printk(KERN_ERR "ivfbdev: dt ERR: num-buffers %u\n", num_buffers);
+		ret = -EINVAL;
+		goto out;
+	}
 
-	info = framebuffer_alloc(sizeof(struct fb_info), &dev->dev);
-	if (!info) goto out;
+	info = framebuffer_alloc(sizeof(struct iveia_fb_par), &dev->dev);
+	if (!info) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
-	info->screen_base = (char __iomem *) fb_addr;
 	info->fbops = &iveia_fb_ops;
 
-    info->var = iveia_fb_default;
 	info->fix = iveia_fb_fix;
+	info->var.xres = info->var.xres_virtual = dt_resolution[0];
+	info->var.yres = info->var.yres_virtual = dt_resolution[1];
+	ret = iveia_fb_set_format(&info->var, dt_resolution[2]);
+	if (ret) {
+		printk(KERN_ERR "ivfbdev: dt ERR: %u bpp not supported\n", dt_resolution[2]);
+		goto out;
+	}
+	info->fix.line_length = info->var.xres * info->var.bits_per_pixel / 8;
+	info->fix.smem_start = mem_start;
 	info->flags = FBINFO_FLAG_DEFAULT;
 	info->pseudo_palette = pseudo_palette;
 
     par = info->par;
+	init_waitqueue_head(&par->vsync_wait);
+
+	res = platform_get_resource(dev, IORESOURCE_MEM, ctrl_index);
+	if ( res ) {
+		par->misc_reg = devm_ioremap_resource(&dev->dev, res);
+		if ( IS_ERR(par->misc_reg) ) {
+			ret = PTR_ERR(par->misc_reg);
+			par->misc_reg = NULL;
+			goto out;
+		}
+	}
+
+	par->irq = platform_get_irq_optional(dev, 0);
+	if ( par->irq == -EPROBE_DEFER ) {
+		ret = par->irq;
+		goto out;
+	}
+	if ( par->irq > 0 ) {
+		if ( ! par->misc_reg ) {
+			printk(KERN_ERR "ivfbdev: dt ERR: interrupts without control registers\n");
+			ret = -EINVAL;
+			goto out;
+		}
+		ret = devm_request_irq(&dev->dev, par->irq, iveia_fb_isr, IRQF_SHARED, MODNAME, par);
+		if (ret) {
+			par->irq = 0;
+			goto out;
+		}
+	}
+
+	if ( par->misc_reg ) {
+		info->var.yres_virtual = info->var.yres * num_buffers;
+		info->fix.ypanstep = 1;
+	} else if ( num_buffers > 1 ) {
+		printk(KERN_WARNING "ivfbdev: num-buffers needs control registers, using 1\n");
+	}
+
+	size = info->var.yres_virtual * info->fix.line_length;
+	if ( PAGE_ALIGN(size) > mem_size ) {
+		printk(KERN_ERR "ivfbdev: %lu bytes of video memory needed, have %pa\n", size, &mem_size);
+		ret = -ENOMEM;
+		goto out;
+	}
+	info->fix.smem_len = PAGE_ALIGN(size);
+
+    fb_addr = memremap(info->fix.smem_start, info->fix.smem_len, MEMREMAP_WC);
+	if ( ! fb_addr ) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	info->screen_base = (char __iomem *) fb_addr;
+
+    /*
+     * Don't erase the screen - u-boot already put up a splash screen.
+     */
+    if (0) {
+        memset(fb_addr, 0, info->fix.smem_len);
+    }
+
+	if ( shadow ) {
+		par->shadow = vmalloc(PAGE_ALIGN(size));
+		if ( ! par->shadow ) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		// Keep the splash screen
+		memcpy_fromio(par->shadow, fb_addr, size);
+
+		spin_lock_init(&par->dirty_lock);
+		par->defio.delay = msecs_to_jiffies(shadow_flush_ms);
+		par->defio.deferred_io = iveia_fb_deferred_io;
+
+		info->screen_base = (char __iomem *) par->shadow;
+		info->flags |= FBINFO_VIRTFB;
+		info->fbdefio = &par->defio;
+		fb_deferred_io_init(info);
+	}
 
 	ret = register_framebuffer(info);
 	if (ret < 0) goto out;
@@ -173,16 +523,27 @@ static int iveia_fb_probe(struct platform_device *dev)
 	platform_set_drvdata(dev, info);
 
 	printk(KERN_INFO
-	       "fb%d: iVeia frame buffer device, using %ldK of video memory\n",
-	       info->node, (unsigned long) (iveia_fb_fix.smem_len >> 10));
+	       "fb%d: iVeia frame buffer device, using %ldK of video memory, %u buffers%s\n",
+	       info->node, (unsigned long) (info->fix.smem_len >> 10),
+	       info->var.yres_virtual / info->var.yres,
+	       par->shadow ? ", shadowed" : "");
 	return 0;
 
 out:
 	printk(KERN_WARNING "fb: Could not intitalize fb device (err %d)\n", ret);
-    if (info)
+    if (info) {
+        // par goes with info, so the IRQ can't wait for devm
+        if (par && par->irq > 0)
+            devm_free_irq(&dev->dev, par->irq, par);
+        if (info->fbdefio)
+            fb_deferred_io_cleanup(info);
+        if (par)
+            vfree(par->shadow);
         framebuffer_release(info);
+    }
     if (fb_addr)
-        iounmap(fb_addr);
+        memunmap(fb_addr);
+    fb_addr = NULL;
 
 	return ret;
 }
@@ -193,12 +554,18 @@ static int iveia_fb_remove(struct platform_device *dev)
     struct iveia_fb_par * par;
 
 	if (info) {
+        par = info->par;
+
 		unregister_framebuffer(info);
+        if (par->irq > 0)
+            devm_free_irq(&dev->dev, par->irq, par);
+        if (info->fbdefio)
+            fb_deferred_io_cleanup(info);
+        vfree(par->shadow);
         if (fb_addr)
-            iounmap(fb_addr);
+            memunmap(fb_addr);
+        fb_addr = NULL;
 		framebuffer_release(info);
-
-        par = info->par;
 	}
 	return 0;
 }
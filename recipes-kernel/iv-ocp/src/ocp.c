@@ -26,6 +26,22 @@
 #include <linux/cdev.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/iopoll.h>
+#include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/sched/signal.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hashtable.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
+#include <asm/cacheflush.h>
+#if defined(CONFIG_ARM)
+#include <asm/outercache.h>
+#endif
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <linux/errno.h>
@@ -36,12 +52,52 @@
 #include <linux/platform_device.h>
 
 #include "ocp.h"
+#include "events.h"     // iv-events' in-kernel waiters, fetched from its recipe; only
+                        // used through symbol_get(), so iv-events is optional
+
+#define CREATE_TRACE_POINTS
+#include "ocp_trace.h"
+
+/*
+ * read()/write() go through a per-mapping bounce buffer, filled/drained with
+ * 32-bit accesses, in chunks of up to OCP_BOUNCE_SIZE.
+ */
+#define OCP_BOUNCE_SIZE PAGE_SIZE
+
+/*
+ * Trace mode profile: per register (offset an access starts at) counts and
+ * log2(ns) latency histograms.  Registers past OCP_PROF_MAX_ENTRIES per
+ * mapping are only counted as dropped.
+ */
+#define OCP_PROF_HASH_BITS      6
+#define OCP_PROF_MAX_ENTRIES    1024
+#define OCP_PROF_LAT_BUCKETS    24
+
+struct ocp_prof_entry {
+    struct hlist_node node;
+    u64 offset;
+    u64 reads;
+    u64 writes;
+    u64 bytes;
+    u64 total_ns;
+    u64 max_ns;
+    u32 hist[OCP_PROF_LAT_BUCKETS];
+};
 
- 
 struct ocp_mapping {
     u64 phys;
     u64 size;
     void *virt;
+    int type;               // OCP_MEM_*
+    int index;              // N of /dev/ocpN
+
+    struct mutex lock;      // Serializes read()/write() on this mapping
+    void *bounce;
+
+    // Trace mode profile, under lock
+    DECLARE_HASHTABLE(prof, OCP_PROF_HASH_BITS);
+    int prof_entries;
+    u64 prof_dropped;
 };
 
 struct ocp_dev {
@@ -55,10 +111,19 @@ struct ocp_dev {
 
     int num_addr_spaces;
     struct ocp_mapping *mappings;
+
+    struct dentry *dbg_dentry;
 };
 
 #define MODNAME "ocp"
 
+static bool burst = true;
+module_param(burst, bool, 0644);
+MODULE_PARM_DESC(burst, "Use the bounce buffered read()/write() path (0 copies to/from the mapping directly, for comparison)");
+
+static bool trace = false;
+module_param(trace, bool, 0644);
+MODULE_PARM_DESC(trace, "Time read()/write()/batch accesses, for the ocp tracepoints and the debugfs profile");
 
 
 static unsigned int minor_to_mapping_index(unsigned int minor){
@@ -67,6 +132,150 @@ static unsigned int minor_to_mapping_index(unsigned int minor){
     return minor - 1;
 }
 
+/*
+ * Bounce buffer <-> mapping.  Device memory is accessed a 32-bit word at a
+ * time; the others are normal memory.
+ */
+static void ocp_copy_from_mapping(struct ocp_mapping *mapping, void *to, loff_t off, size_t count)
+{
+    if ( mapping->type == OCP_MEM_DEVICE )
+        __ioread32_copy(to, mapping->virt + off, count / sizeof(u32));
+    else
+        memcpy(to, mapping->virt + off, count);
+}
+
+static void ocp_copy_to_mapping(struct ocp_mapping *mapping, loff_t off, const void *from, size_t count)
+{
+    if ( mapping->type == OCP_MEM_DEVICE )
+        __iowrite32_copy(mapping->virt + off, from, count / sizeof(u32));
+    else
+        memcpy(mapping->virt + off, from, count);
+}
+
+static inline int ocp_prof_bucket(u64 ns)
+{
+    return ns ? min_t(int, ilog2(ns), OCP_PROF_LAT_BUCKETS - 1) : 0;
+}
+
+/*
+ * Add an access to the profile.  Called with mapping->lock held.
+ */
+static void ocp_prof_add(struct ocp_mapping *mapping, u64 offset, u32 size, bool is_write, u64 ns)
+{
+    struct ocp_prof_entry *entry;
+
+    hash_for_each_possible(mapping->prof, entry, node, offset) {
+        if ( entry->offset == offset )
+            goto found;
+    }
+
+    if ( mapping->prof_entries >= OCP_PROF_MAX_ENTRIES ) {
+        mapping->prof_dropped++;
+        return;
+    }
+    entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+    if ( ! entry ) {
+        mapping->prof_dropped++;
+        return;
+    }
+    entry->offset = offset;
+    hash_add(mapping->prof, &entry->node, offset);
+    mapping->prof_entries++;
+
+found:
+    if ( is_write )
+        entry->writes++;
+    else
+        entry->reads++;
+    entry->bytes += size;
+    entry->total_ns += ns;
+    entry->max_ns = max(entry->max_ns, ns);
+    entry->hist[ocp_prof_bucket(ns)]++;
+}
+
+static void ocp_prof_clear(struct ocp_mapping *mapping)
+{
+    struct ocp_prof_entry *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(mapping->prof, bkt, tmp, entry, node) {
+        hash_del(&entry->node);
+        kfree(entry);
+    }
+    mapping->prof_entries = 0;
+    mapping->prof_dropped = 0;
+}
+
+/*
+ * Trace mode: time the bus side of each access, and once done, fire its
+ * tracepoint and profile it.  Called with mapping->lock held.  trace can
+ * change at any time, so each access reads it once, with ocp_tracing(), and
+ * passes that on.
+ */
+static inline bool ocp_tracing(void)
+{
+    return READ_ONCE(trace);
+}
+
+static inline u64 ocp_trace_start(bool traced)
+{
+    return traced ? ktime_get_ns() : 0;
+}
+
+static inline u64 ocp_trace_elapsed(bool traced, u64 start)
+{
+    return traced ? ktime_get_ns() - start : 0;
+}
+
+static void ocp_trace_access(bool traced, struct ocp_mapping *mapping, u64 offset, u32 size, bool is_write, u64 ns)
+{
+    if ( ! traced )
+        return;
+
+    if ( is_write )
+        trace_ocp_write(mapping->index, offset, size, ns);
+    else
+        trace_ocp_read(mapping->index, offset, size, ns);
+    ocp_prof_add(mapping, offset, size, is_write, ns);
+}
+
+static void ocp_trace_batch_op(bool traced, struct ocp_mapping *mapping, struct ocp_batch_op *op, u64 ns)
+{
+    if ( ! traced )
+        return;
+
+    trace_ocp_batch_op(mapping->index, op->offset, op->op, op->value, ns);
+    ocp_prof_add(mapping, op->offset, sizeof(u32), op->op == OCP_BATCH_WRITE || op->op == OCP_BATCH_RMW, ns);
+}
+
+/*
+ * Make a range of a mapping coherent with the PL.  A cacheable range is
+ * written back and invalidated either way, so a SYNC_FOR_CPU can't lose
+ * what the CPU wrote but didn't yet sync for the device.
+ */
+static void ocp_sync(struct ocp_mapping *mapping, u64 offset, u64 size, bool for_device)
+{
+    switch ( mapping->type ) {
+        case OCP_MEM_CACHEABLE:
+#if defined(CONFIG_ARM64)
+            __flush_dcache_area(mapping->virt + offset, size);
+#else
+            __cpuc_flush_dcache_area(mapping->virt + offset, size);
+            outer_flush_range(mapping->phys + offset, mapping->phys + offset + size);
+#endif
+            break;
+
+        case OCP_MEM_WRITE_COMBINE:
+            if ( for_device )
+                wmb();
+            break;
+
+        default:
+            break;
+    }
+}
+
 /*
  * open()
  */
@@ -101,7 +310,13 @@ ssize_t ocp_read(struct file *filp, char __user *buf, size_t count,
 {
     struct ocp_dev *dev = filp->private_data; 
     unsigned int minor = iminor(filp->f_path.dentry->d_inode);
+    struct ocp_mapping *mapping;
     ssize_t retval = 0;
+    size_t done = 0;
+    size_t chunk;
+    bool traced = ocp_tracing();
+    u64 start;
+    u64 ns = 0;
 
     if (minor > dev->num_addr_spaces) return -ENODEV;
 
@@ -112,11 +327,13 @@ ssize_t ocp_read(struct file *filp, char __user *buf, size_t count,
             "(64-bit system : User read 'unsigned long', driver expected 'uint32_t').\n");
 #endif
 
-    if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
+    mapping = &dev->mappings[minor_to_mapping_index(minor)];
 
-    if (*f_pos >= dev->mappings[minor_to_mapping_index(minor)].size) goto out;
-    if (*f_pos + count > dev->mappings[minor_to_mapping_index(minor)].size) {
-        count = dev->mappings[minor_to_mapping_index(minor)].size - *f_pos;
+    if (mutex_lock_interruptible(&mapping->lock)) return -ERESTARTSYS;
+
+    if (*f_pos >= mapping->size) goto out;
+    if (*f_pos + count > mapping->size) {
+        count = mapping->size - *f_pos;
     }
     if ( count % sizeof(unsigned int) != 0 || ((unsigned int) buf) % sizeof(unsigned int) != 0 )
     {
@@ -124,17 +341,35 @@ ssize_t ocp_read(struct file *filp, char __user *buf, size_t count,
         goto out;
     }
 
-    if (copy_to_user(buf, (void *)((uintptr_t)dev->mappings[minor_to_mapping_index(minor)].virt + *f_pos), count)) {
-        retval = -EFAULT;
-        goto out;
+    if ( ! burst ) {
+        start = ocp_trace_start(traced);
+        if (copy_to_user(buf, (void *)((uintptr_t)mapping->virt + *f_pos), count)) {
+            retval = -EFAULT;
+            goto out;
+        }
+        ns = ocp_trace_elapsed(traced, start);
+        done = count;
+    }
+
+    while ( done < count ) {
+        chunk = min_t(size_t, count - done, OCP_BOUNCE_SIZE);
+        start = ocp_trace_start(traced);
+        ocp_copy_from_mapping(mapping, mapping->bounce, *f_pos + done, chunk);
+        ns += ocp_trace_elapsed(traced, start);
+        if (copy_to_user(buf + done, mapping->bounce, chunk)) {
+            retval = -EFAULT;
+            goto out;
+        }
+        done += chunk;
     }
 
+    ocp_trace_access(traced, mapping, *f_pos, count, false, ns);
     *f_pos += count;
 
     retval = count;
 
 out:
-    up(&dev->sem);
+    mutex_unlock(&mapping->lock);
     return retval;
 }
 
@@ -146,7 +381,13 @@ ssize_t ocp_write(struct file *filp, const char __user *buf, size_t count,
 {
     struct ocp_dev *dev = filp->private_data; 
     unsigned int minor = iminor(filp->f_path.dentry->d_inode);
+    struct ocp_mapping *mapping;
     ssize_t retval = 0;
+    size_t done = 0;
+    size_t chunk;
+    bool traced = ocp_tracing();
+    u64 start;
+    u64 ns = 0;
 
     if (minor > dev->num_addr_spaces) return -ENODEV;
 
@@ -157,11 +398,13 @@ ssize_t ocp_write(struct file *filp, const char __user *buf, size_t count,
             "(64-bit system : User wrote 'unsigned long', driver expected 'uint32_t').\n");
 #endif
 
-    if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
+    mapping = &dev->mappings[minor_to_mapping_index(minor)];
+
+    if (mutex_lock_interruptible(&mapping->lock)) return -ERESTARTSYS;
 
-    if (*f_pos >= dev->mappings[minor_to_mapping_index(minor)].size) goto out;
-    if (*f_pos + count > dev->mappings[minor_to_mapping_index(minor)].size) {
-        count = dev->mappings[minor_to_mapping_index(minor)].size - *f_pos;
+    if (*f_pos >= mapping->size) goto out;
+    if (*f_pos + count > mapping->size) {
+        count = mapping->size - *f_pos;
     }
     if ( count % sizeof(unsigned int) != 0 || ((unsigned int) buf) % sizeof(unsigned int) != 0 )
     {
@@ -169,17 +412,267 @@ ssize_t ocp_write(struct file *filp, const char __user *buf, size_t count,
         goto out;
     }
 
-    if (copy_from_user((void *)(dev->mappings[minor_to_mapping_index(minor)].virt + *f_pos), buf, count)) {
-        retval = -EFAULT;
-        goto out;
+    if ( ! burst ) {
+        start = ocp_trace_start(traced);
+        if (copy_from_user((void *)(mapping->virt + *f_pos), buf, count)) {
+            retval = -EFAULT;
+            goto out;
+        }
+        ns = ocp_trace_elapsed(traced, start);
+        done = count;
     }
 
+    while ( done < count ) {
+        chunk = min_t(size_t, count - done, OCP_BOUNCE_SIZE);
+        if (copy_from_user(mapping->bounce, buf + done, chunk)) {
+            retval = -EFAULT;
+            goto out;
+        }
+        start = ocp_trace_start(traced);
+        ocp_copy_to_mapping(mapping, *f_pos + done, mapping->bounce, chunk);
+        ns += ocp_trace_elapsed(traced, start);
+        done += chunk;
+    }
+
+    ocp_trace_access(traced, mapping, *f_pos, count, true, ns);
     *f_pos += count;
 
     retval = count;
 
 out:
-    up(&dev->sem);
+    mutex_unlock(&mapping->lock);
+    return retval;
+}
+
+/*
+ * OCP_IOC_BATCH
+ */
+static long ocp_batch(struct file *filp, struct ocp_batch __user *ubatch)
+{
+    struct ocp_dev *dev = filp->private_data;
+    unsigned int minor = iminor(filp->f_path.dentry->d_inode);
+    struct ocp_mapping *mapping;
+    struct ocp_batch batch;
+    struct ocp_batch_op *ops;
+    struct ocp_batch_op *op;
+    void *reg;
+    long retval = 0;
+    u32 done;
+    u32 val;
+    bool traced = ocp_tracing();
+    u64 start;
+    ktime_t poll_deadline;
+    s64 poll_us;
+
+    if (minor > dev->num_addr_spaces) return -ENODEV;
+    mapping = &dev->mappings[minor_to_mapping_index(minor)];
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch))) return -EFAULT;
+    if (batch.count == 0 || batch.count > OCP_BATCH_MAX) return -EINVAL;
+    if (batch.poll_timeout_us > OCP_BATCH_MAX_POLL_US) return -EINVAL;
+
+    ops = kmalloc_array(batch.count, sizeof(struct ocp_batch_op), GFP_KERNEL);
+    if (!ops) return -ENOMEM;
+
+    if (copy_from_user(ops, u64_to_user_ptr(batch.ops), batch.count * sizeof(struct ocp_batch_op))) {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    for ( done = 0; done < batch.count; done++ ) {
+        op = &ops[done];
+        if ( op->offset % sizeof(u32) != 0 || op->offset + sizeof(u32) > mapping->size || op->op > OCP_BATCH_POLL ) {
+            retval = -EINVAL;
+            goto out;
+        }
+    }
+
+    if (mutex_lock_interruptible(&mapping->lock)) {
+        retval = -ERESTARTSYS;
+        goto out;
+    }
+
+    // The mapping is held for the whole batch, so its polls share one budget
+    poll_deadline = ktime_add_us(ktime_get(), OCP_BATCH_MAX_POLL_US);
+
+    for ( done = 0; done < batch.count; done++ ) {
+        op = &ops[done];
+        reg = mapping->virt + op->offset;
+        start = ocp_trace_start(traced);
+
+        switch ( op->op ) {
+            case OCP_BATCH_READ:
+                op->value = readl(reg);
+                break;
+
+            case OCP_BATCH_WRITE:
+                writel(op->value, reg);
+                break;
+
+            case OCP_BATCH_RMW:
+                val = readl(reg);
+                writel((val & ~op->mask) | (op->value & op->mask), reg);
+                op->value = val;
+                break;
+
+            case OCP_BATCH_POLL:
+                // A timeout of 0 would mean forever to readl_poll_timeout()
+                poll_us = min_t(s64, batch.poll_timeout_us, ktime_us_delta(poll_deadline, ktime_get()));
+                if ( poll_us > 0 ) {
+                    retval = readl_poll_timeout(reg, val, (val & op->mask) == op->value,
+                                                OCP_WAIT_MIN_SLEEP_US, poll_us);
+                } else {
+                    val = readl(reg);
+                    retval = (val & op->mask) == op->value ? 0 : -ETIMEDOUT;
+                }
+                op->value = val;
+                break;
+        }
+        ocp_trace_batch_op(traced, mapping, op, ocp_trace_elapsed(traced, start));
+        if ( retval )
+            break;
+    }
+
+    mutex_unlock(&mapping->lock);
+
+    batch.done = done;
+    if (copy_to_user(u64_to_user_ptr(batch.ops), ops, batch.count * sizeof(struct ocp_batch_op))
+        || copy_to_user(ubatch, &batch, sizeof(batch))) {
+        retval = -EFAULT;
+    }
+
+out:
+    kfree(ops);
+    return retval;
+}
+
+#define OCP_WAIT_DONE(val, pwait) ((( val ) & ( pwait )->mask ) == ( pwait )->value )
+
+/*
+ * OCP_IOC_WAIT, once spinning is over: sleep until the condition is met or
+ * the deadline passes, on a backed off timer.
+ */
+static int ocp_wait_backoff(void *reg, struct ocp_wait *pwait, ktime_t deadline)
+{
+    unsigned long delay = OCP_WAIT_MIN_SLEEP_US;
+    s64 remaining;
+    u32 val;
+
+    for (;;) {
+        remaining = ktime_us_delta(deadline, ktime_get());
+        if ( remaining <= 0 )
+            return -ETIMEDOUT;
+        if ( signal_pending(current) )
+            return -ERESTARTSYS;
+
+        delay = min_t(unsigned long, delay, remaining);
+        usleep_range(delay, delay + delay / 4);
+
+        val = readl(reg);
+        pwait->result = val;
+        if ( OCP_WAIT_DONE(val, pwait) )
+            return 0;
+
+        delay = min(delay * 2, (unsigned long)OCP_WAIT_MAX_SLEEP_US);
+    }
+}
+
+/*
+ * Same, sleeping on an iv-events event instead.  The register is still
+ * checked every OCP_WAIT_MAX_SLEEP_US * 10, in case the event is missed or
+ * isn't the right one.
+ */
+static int ocp_wait_event(void *reg, struct ocp_wait *pwait, ktime_t deadline)
+{
+    const struct events_waiter_ops *ops;
+    struct events_waiter *waiter;
+    s64 remaining;
+    long ret;
+    u32 val;
+    int err;
+
+    ops = symbol_get(events_waiter_ops);
+    if ( ! ops )
+        return -ENODEV;
+
+    waiter = ops->add(pwait->event);
+    if ( IS_ERR(waiter) ) {
+        symbol_put(events_waiter_ops);
+        return PTR_ERR(waiter);
+    }
+
+    for (;;) {
+        // Recheck now the event is armed, and after each occurrence
+        val = readl(reg);
+        pwait->result = val;
+        if ( OCP_WAIT_DONE(val, pwait) ) {
+            err = 0;
+            break;
+        }
+
+        remaining = ktime_us_delta(deadline, ktime_get());
+        if ( remaining <= 0 ) {
+            err = -ETIMEDOUT;
+            break;
+        }
+
+        ret = ops->wait(waiter, usecs_to_jiffies(min_t(s64, remaining, OCP_WAIT_MAX_SLEEP_US * 10)));
+        if ( ret < 0 ) {
+            err = -ERESTARTSYS;
+            break;
+        }
+    }
+
+    ops->remove(waiter);
+    symbol_put(events_waiter_ops);
+
+    return err;
+}
+
+/*
+ * OCP_IOC_WAIT
+ */
+static long ocp_wait(struct file *filp, struct ocp_wait __user *uwait)
+{
+    struct ocp_dev *dev = filp->private_data;
+    unsigned int minor = iminor(filp->f_path.dentry->d_inode);
+    struct ocp_mapping *mapping;
+    struct ocp_wait wait;
+    ktime_t start, deadline;
+    u32 spin_us;
+    void *reg;
+    long retval;
+    u32 val;
+
+    if (minor > dev->num_addr_spaces) return -ENODEV;
+    mapping = &dev->mappings[minor_to_mapping_index(minor)];
+
+    if (copy_from_user(&wait, uwait, sizeof(wait))) return -EFAULT;
+    if ( wait.offset % sizeof(u32) != 0 || wait.offset + sizeof(u32) > mapping->size ) return -EINVAL;
+    reg = mapping->virt + wait.offset;
+
+    start = ktime_get();
+    deadline = ktime_add_us(start, wait.timeout_us);
+
+    spin_us = min3(wait.spin_us, wait.timeout_us, (u32)OCP_BATCH_MAX_POLL_US);
+    if ( spin_us ) {
+        retval = readl_poll_timeout_atomic(reg, val, OCP_WAIT_DONE(val, &wait), 0, spin_us);
+    } else {
+        val = readl(reg);
+        retval = OCP_WAIT_DONE(val, &wait) ? 0 : -ETIMEDOUT;
+    }
+    wait.result = val;
+
+    if ( retval && wait.timeout_us > spin_us ) {
+        if ( wait.event >= 0 )
+            retval = ocp_wait_event(reg, &wait, deadline);
+        else
+            retval = ocp_wait_backoff(reg, &wait, deadline);
+    }
+
+    wait.elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    if (copy_to_user(uwait, &wait, sizeof(wait))) return -EFAULT;
+
     return retval;
 }
 
@@ -209,6 +702,32 @@ long ocp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         err =  !access_ok((void __user *)arg, _IOC_SIZE(cmd));
     }
     if (err) return -EFAULT;
+
+    // Only takes the lock of the mapping it works on
+    if (cmd == OCP_IOC_BATCH) return ocp_batch(filp, (struct ocp_batch __user *)arg);
+
+    // Only reads, and may sleep for a long time, so takes no lock
+    if (cmd == OCP_IOC_WAIT) return ocp_wait(filp, (struct ocp_wait __user *)arg);
+
+    // Need no lock at all
+    if (cmd == OCP_IOC_R_MEMORY_TYPE || cmd == OCP_IOC_W_SYNC_FOR_DEVICE || cmd == OCP_IOC_W_SYNC_FOR_CPU) {
+        unsigned int minor = iminor(filp->f_path.dentry->d_inode);
+        struct ocp_mapping *mapping;
+        struct ocp_sync sync;
+
+        if (minor > dev->num_addr_spaces) return -ENODEV;
+        mapping = &dev->mappings[minor_to_mapping_index(minor)];
+
+        if (cmd == OCP_IOC_R_MEMORY_TYPE) {
+            __put_user((unsigned long)mapping->type, (unsigned long __user *)arg);
+            return 0;
+        }
+
+        if (copy_from_user(&sync, (void __user *)arg, sizeof(sync))) return -EFAULT;
+        if (sync.offset >= mapping->size || sync.size > mapping->size - sync.offset) return -EINVAL;
+        ocp_sync(mapping, sync.offset, sync.size, cmd == OCP_IOC_W_SYNC_FOR_DEVICE);
+        return 0;
+    }
     
     if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
     switch(cmd) {
@@ -233,8 +752,6 @@ loff_t ocp_llseek(struct file *filp, loff_t off, int whence)
 
     if (minor > dev->num_addr_spaces) return -ENODEV;
 
-    if (down_interruptible(&dev->sem)) return -ERESTARTSYS;
-
     switch(whence) {
       case 0: /* SEEK_SET */
         newpos = off;
@@ -265,7 +782,6 @@ loff_t ocp_llseek(struct file *filp, loff_t off, int whence)
     filp->f_pos = newpos;
 
 out:
-    up(&dev->sem);
     return newpos;
 }
 
@@ -292,15 +808,96 @@ static int ocp_mmap(struct file *filp, struct vm_area_struct *vma)
 
     pfn = (ulPhysStart >> PAGE_SHIFT);
 
-    vma->vm_page_prot = phys_mem_access_prot(filp, pfn,
-                         size,
-                         vma->vm_page_prot);
+    switch ( dev->mappings[minor_to_mapping_index(minor)].type ) {
+        case OCP_MEM_WRITE_COMBINE:
+            vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+            break;
+
+        case OCP_MEM_CACHEABLE:
+            // Leave as normal cacheable memory
+            break;
+
+        default:
+            vma->vm_page_prot = phys_mem_access_prot(filp, pfn,
+                                 size,
+                                 vma->vm_page_prot);
+            break;
+    }
     ret = remap_pfn_range(vma, vma->vm_start, pfn, size, vma->vm_page_prot);
     if (ret) return -EAGAIN;
 
     return 0;
 }
 
+/*
+ * debugfs ocpN_profile: trace mode profile of /dev/ocpN, hottest registers
+ * first, with one column per log2(ns) latency bucket.
+ */
+static int ocp_prof_cmp(const void *a, const void *b)
+{
+    const struct ocp_prof_entry *ea = *(const struct ocp_prof_entry **)a;
+    const struct ocp_prof_entry *eb = *(const struct ocp_prof_entry **)b;
+    u64 na = ea->reads + ea->writes;
+    u64 nb = eb->reads + eb->writes;
+
+    if ( na != nb )
+        return na > nb ? -1 : 1;
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+static int profile_show(struct seq_file *s, void *unused)
+{
+    struct ocp_mapping *mapping = (struct ocp_mapping *)s->private;
+    struct ocp_prof_entry **entries;
+    struct ocp_prof_entry *entry;
+    int n = 0;
+    int bkt;
+    int i, j;
+
+    if (mutex_lock_interruptible(&mapping->lock)) return -ERESTARTSYS;
+
+    entries = kmalloc_array(max(mapping->prof_entries, 1), sizeof(*entries), GFP_KERNEL);
+    if ( ! entries ) {
+        mutex_unlock(&mapping->lock);
+        return -ENOMEM;
+    }
+    hash_for_each(mapping->prof, bkt, entry, node)
+        entries[n++] = entry;
+    sort(entries, n, sizeof(*entries), ocp_prof_cmp, NULL);
+
+    seq_printf(s, "# ocp%d: %d registers, %llu accesses dropped\n", mapping->index, n, mapping->prof_dropped);
+    seq_printf(s, "# %-10s %10s %10s %12s %8s %8s  histogram\n", "offset", "reads", "writes", "bytes", "avg_ns", "max_ns");
+    for ( i = 0; i < n; i++ ) {
+        entry = entries[i];
+        seq_printf(s, "0x%08llx %10llu %10llu %12llu %8llu %8llu ",
+            entry->offset, entry->reads, entry->writes, entry->bytes,
+            div64_u64(entry->total_ns, entry->reads + entry->writes), entry->max_ns);
+        for ( j = 0; j < OCP_PROF_LAT_BUCKETS; j++ )
+            seq_printf(s, " %u", entry->hist[j]);
+        seq_puts(s, "\n");
+    }
+
+    kfree(entries);
+    mutex_unlock(&mapping->lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(profile);
+
+static int profile_reset_set(void *data, u64 val)
+{
+    struct ocp_dev *dev = (struct ocp_dev *)data;
+    int i;
+
+    for ( i = 0; i < dev->num_addr_spaces; i++ ) {
+        mutex_lock(&dev->mappings[i].lock);
+        ocp_prof_clear(&dev->mappings[i]);
+        mutex_unlock(&dev->mappings[i].lock);
+    }
+
+    return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(profile_reset_fops, NULL, profile_reset_set, "%llu\n");
+
 struct file_operations ocp_fops = {
     .owner =    THIS_MODULE,
     .read =     ocp_read,
@@ -324,11 +921,18 @@ static int ocp_remove(struct platform_device *pdev)
 
     pr_info("ocp: REMOVE\n");
 
+    debugfs_remove_recursive( ocp_devp->dbg_dentry );
+
     if ( ocp_devp->mappings ) {
         for ( i = 0; i < ocp_devp->num_addr_spaces; i++ ) {
+            ocp_prof_clear( &ocp_devp->mappings[i] );
             if ( ocp_devp->mappings[i].virt ) {
-                iounmap( (void *)ocp_devp->mappings[i].virt );
+                if ( ocp_devp->mappings[i].type == OCP_MEM_CACHEABLE )
+                    memunmap( ocp_devp->mappings[i].virt );
+                else
+                    iounmap( (void *)ocp_devp->mappings[i].virt );
             }
+            kfree( ocp_devp->mappings[i].bounce );
 
             device_destroy( ocp_devp->class, MKDEV(MAJOR(ocp_devp->node),i+1) );
         }
@@ -352,6 +956,7 @@ static int ocp_probe(struct platform_device *pdev)
     int i;
     struct ocp_dev *ocp_devp;
     struct ocp_mapping *mapping;
+    const char *type;
 
     pr_info("ocp: PROBE\n");
 
@@ -395,8 +1000,18 @@ static int ocp_probe(struct platform_device *pdev)
     sema_init(&ocp_devp->sem, 1);
     ocp_devp->instance_count = 0;
 
+    // debugfs is only diagnostics: its failures are not fatal, and its
+    // functions take an error from a previous call in stride
+    ocp_devp->dbg_dentry = debugfs_create_dir(MODNAME, NULL);
+    debugfs_create_file("profile_reset", 0222, ocp_devp->dbg_dentry, ocp_devp, &profile_reset_fops);
+
     for ( i = 0; i < ocp_devp->num_addr_spaces; i++ ) {
+        char name[32];
+
         mapping = &ocp_devp->mappings[i];
+        mapping->index = i;
+        mutex_init(&mapping->lock);
+        hash_init(mapping->prof);
 
         if ( of_property_read_u64_index(pdev->dev.of_node, "reg", (i*2), &mapping->phys ) != 0 ) {
             break;
@@ -405,14 +1020,46 @@ static int ocp_probe(struct platform_device *pdev)
             break;
         }
 
-        mapping->virt = ioremap( mapping->phys, mapping->size );
+        mapping->type = OCP_MEM_DEVICE;
+        if ( of_property_read_string_index(pdev->dev.of_node, "memory-types", i, &type ) == 0 ) {
+            if ( strcmp(type, "write-combine") == 0 ) {
+                mapping->type = OCP_MEM_WRITE_COMBINE;
+            } else if ( strcmp(type, "cacheable") == 0 ) {
+                mapping->type = OCP_MEM_CACHEABLE;
+            } else if ( strcmp(type, "device") != 0 ) {
+                dev_err(ocp_devp->dev, "unknown memory type %s\n", type );
+                err = -EINVAL;
+                goto fail;
+            }
+        }
+
+        switch ( mapping->type ) {
+            case OCP_MEM_WRITE_COMBINE:
+                mapping->virt = ioremap_wc( mapping->phys, mapping->size );
+                break;
+            case OCP_MEM_CACHEABLE:
+                mapping->virt = memremap( mapping->phys, mapping->size, MEMREMAP_WB );
+                break;
+            default:
+                mapping->virt = ioremap( mapping->phys, mapping->size );
+                break;
+        }
         if ( mapping->virt == NULL ) {
             dev_err(ocp_devp->dev, ": Error mapping ocp space\n" );
             err = -ENOMEM;
             goto fail;
         }
 
-        dev_info(ocp_devp->dev, "map 0x%llx -> 0x%llx (0x%llx)\n", mapping->phys, mapping->virt, mapping->size);
+        mapping->bounce = kmalloc( OCP_BOUNCE_SIZE, GFP_KERNEL );
+        if ( mapping->bounce == NULL ) {
+            err = -ENOMEM;
+            goto fail;
+        }
+
+        dev_info(ocp_devp->dev, "map 0x%llx -> 0x%llx (0x%llx), type %d\n", mapping->phys, mapping->virt, mapping->size, mapping->type);
+
+        snprintf(name, sizeof(name), "ocp%d_profile", i);
+        debugfs_create_file(name, 0444, ocp_devp->dbg_dentry, mapping, &profile_fops);
 
         device_create(ocp_devp->class, NULL, MKDEV(MAJOR(ocp_devp->node),i+1), NULL, "ocp%d",i);
     }
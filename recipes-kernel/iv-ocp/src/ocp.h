@@ -4,11 +4,98 @@
 #ifndef _OCP_H_
 #define _OCP_H_
 
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
 /*
  * Ioctl definitions
  */
 #define OCP_IOC_MAGIC  'o'
 #define OCP_IOC_R_INSTANCE_COUNT		_IOR(OCP_IOC_MAGIC,  0, unsigned long)
-#define OCP_IOC_MAXNR 0
+
+/*
+ * Batch of register ops, run in order against the fd's address space with
+ * no other read()/write()/batch on it in between.  Each op's value is
+ * updated with the register value it read (for a write, unchanged).  On
+ * return, done is the number of ops completed: a POLL op that times out
+ * stops the batch with ETIMEDOUT.  POLL ops sleep between reads, and all
+ * those of a batch share a budget of OCP_BATCH_MAX_POLL_US.  All offsets
+ * are checked before any op is run.
+ */
+#define OCP_IOC_BATCH				_IOWR(OCP_IOC_MAGIC,  1, struct ocp_batch)
+
+/*
+ * Memory types.  Each address space is mapped, by the driver and by mmap(),
+ * as given by the matching entry of the optional "memory-types" DT string
+ * list: "device" (the default, for registers), "write-combine", or
+ * "cacheable" (for BRAM/URAM buffers).
+ *
+ * A cacheable address space needs explicit syncs around PL access:
+ * OCP_IOC_W_SYNC_FOR_DEVICE before the PL reads what the CPU wrote, and
+ * OCP_IOC_W_SYNC_FOR_CPU before the CPU reads what the PL wrote.  Both
+ * write back and invalidate the range.  For write-combine, SYNC_FOR_DEVICE
+ * drains the write buffers; for device they do nothing.
+ */
+#define OCP_IOC_R_MEMORY_TYPE			_IOR(OCP_IOC_MAGIC,  2, unsigned long)
+#define OCP_IOC_W_SYNC_FOR_DEVICE		_IOW(OCP_IOC_MAGIC,  3, struct ocp_sync)
+#define OCP_IOC_W_SYNC_FOR_CPU			_IOW(OCP_IOC_MAGIC,  4, struct ocp_sync)
+
+/*
+ * Wait until (reg & mask) == value, or timeout_us.  Busy polls for up to
+ * spin_us (at most OCP_BATCH_MAX_POLL_US), then sleeps: on the given iv-events event, rechecking on each
+ * occurrence, or with event -1, on a timer backing off from
+ * OCP_WAIT_MIN_SLEEP_US to OCP_WAIT_MAX_SLEEP_US.  Fails with ETIMEDOUT if
+ * the condition wasn't met, but result and elapsed_ns are set either way.
+ */
+#define OCP_IOC_WAIT				_IOWR(OCP_IOC_MAGIC,  5, struct ocp_wait)
+
+#define OCP_IOC_MAXNR 5
+
+#define OCP_WAIT_MIN_SLEEP_US	10
+#define OCP_WAIT_MAX_SLEEP_US	1000
+
+#define OCP_MEM_DEVICE		0
+#define OCP_MEM_WRITE_COMBINE	1
+#define OCP_MEM_CACHEABLE	2
+
+struct ocp_wait {
+	__u32 offset;		/* Byte offset in the address space, 32-bit aligned */
+	__u32 mask;
+	__u32 value;
+	__u32 timeout_us;	/* 0 to check once */
+	__u32 spin_us;		/* Busy poll time before sleeping */
+	__s32 event;		/* iv-events event to sleep on, or -1 */
+	__u32 result;		/* Out: last register value */
+	__u32 reserved;
+	__u64 elapsed_ns;	/* Out */
+};
+
+struct ocp_sync {
+	__u64 offset;		/* Byte offset in the address space */
+	__u64 size;		/* Bytes */
+};
+
+#define OCP_BATCH_READ		0	/* value = reg */
+#define OCP_BATCH_WRITE		1	/* reg = value */
+#define OCP_BATCH_RMW		2	/* reg = (reg & ~mask) | (value & mask) */
+#define OCP_BATCH_POLL		3	/* Wait until (reg & mask) == value */
+
+#define OCP_BATCH_MAX		256
+#define OCP_BATCH_MAX_POLL_US	10000
+
+struct ocp_batch_op {
+	__u32 offset;		/* Byte offset in the address space, 32-bit aligned */
+	__u32 op;		/* OCP_BATCH_* */
+	__u32 mask;		/* RMW and POLL */
+	__u32 value;		/* In: value to write or compare.  Out: register value */
+};
+
+struct ocp_batch {
+	__u64 ops;		/* User pointer to count struct ocp_batch_op */
+	__u32 count;		/* At most OCP_BATCH_MAX */
+	__u32 poll_timeout_us;	/* For each POLL op, at most OCP_BATCH_MAX_POLL_US in all */
+	__u32 done;		/* Out: ops completed */
+	__u32 reserved;
+};
 
 #endif
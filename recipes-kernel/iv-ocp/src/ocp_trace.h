@@ -0,0 +1,91 @@
+/*
+ * iVeia OCP tracepoints
+ *
+ * (C) Copyright 2021, iVeia, LLC
+ *
+ * Only fired when the driver's trace parameter is set, as timing each access
+ * costs two clock reads.  Enable with:
+ *
+ *      echo 1 > /sys/module/iv_ocp/parameters/trace
+ *      echo 1 > /sys/kernel/debug/tracing/events/ocp/enable
+ *
+ * Licensed under the GNU/GPL with iVeia disclaimer. See LICENSE for details.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ocp
+
+#if !defined(_OCP_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _OCP_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(ocp_access,
+
+    TP_PROTO(int space, u64 offset, u32 size, u64 ns),
+
+    TP_ARGS(space, offset, size, ns),
+
+    TP_STRUCT__entry(
+        __field(int, space)
+        __field(u64, offset)
+        __field(u32, size)
+        __field(u64, ns)
+    ),
+
+    TP_fast_assign(
+        __entry->space = space;
+        __entry->offset = offset;
+        __entry->size = size;
+        __entry->ns = ns;
+    ),
+
+    TP_printk("ocp%d offset=0x%llx size=%u ns=%llu",
+        __entry->space, __entry->offset, __entry->size, __entry->ns)
+);
+
+DEFINE_EVENT(ocp_access, ocp_read,
+    TP_PROTO(int space, u64 offset, u32 size, u64 ns),
+    TP_ARGS(space, offset, size, ns)
+);
+
+DEFINE_EVENT(ocp_access, ocp_write,
+    TP_PROTO(int space, u64 offset, u32 size, u64 ns),
+    TP_ARGS(space, offset, size, ns)
+);
+
+TRACE_EVENT(ocp_batch_op,
+
+    TP_PROTO(int space, u32 offset, u32 op, u32 value, u64 ns),
+
+    TP_ARGS(space, offset, op, value, ns),
+
+    TP_STRUCT__entry(
+        __field(int, space)
+        __field(u32, offset)
+        __field(u32, op)
+        __field(u32, value)
+        __field(u64, ns)
+    ),
+
+    TP_fast_assign(
+        __entry->space = space;
+        __entry->offset = offset;
+        __entry->op = op;
+        __entry->value = value;
+        __entry->ns = ns;
+    ),
+
+    TP_printk("ocp%d offset=0x%x op=%s value=0x%x ns=%llu",
+        __entry->space, __entry->offset,
+        __print_symbolic(__entry->op,
+            { 0, "read" }, { 1, "write" }, { 2, "rmw" }, { 3, "poll" }),
+        __entry->value, __entry->ns)
+);
+
+#endif /* _OCP_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ocp_trace
+#include <trace/define_trace.h>
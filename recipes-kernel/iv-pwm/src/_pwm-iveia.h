@@ -0,0 +1,44 @@
+#ifndef __PWM_IVEIA_H_
+#define __PWM_IVEIA_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Waveform sequencer
+ *
+ * A PWM block with a sequencer has a /dev/ivpwmN, where N is the PWM chip's
+ * base.  An fd picks one of the block's channels with IVPWM_IOC_W_CHANNEL.
+ * Set the channel's period and enable it through the PWM API (e.g. sysfs)
+ * as usual, then IVPWM_IOC_W_SEQ_START it.  From then on, write() arrays of
+ * __u32 duty cycles in ns: the block plays one every rate_ns from a FIFO,
+ * holding the last one when the FIFO runs dry.
+ *
+ * write() queues as many values as fit in the FIFO, then sleeps for room,
+ * unless the fd is O_NONBLOCK (-EAGAIN if none fit).  Only the fd that
+ * started a channel can write to it, until it stops it or is closed.
+ */
+#define IVPWM_IOC_MAGIC  'w'
+
+#define IVPWM_IOC_W_CHANNEL			_IOW(IVPWM_IOC_MAGIC,  0, unsigned long)
+
+struct ivpwm_seq_start {
+    __u32 rate_ns;              // Time each value is played for
+    __u32 flags;                // None yet, must be 0
+};
+
+#define IVPWM_IOC_W_SEQ_START			_IOW(IVPWM_IOC_MAGIC,  1, struct ivpwm_seq_start)
+#define IVPWM_IOC_SEQ_STOP			_IO(IVPWM_IOC_MAGIC,  2)
+
+struct ivpwm_seq_status {
+    __u32 running;
+    __u32 level;                // Values queued in the FIFO
+    __u32 depth;                // FIFO size
+    __u32 reserved;
+};
+
+#define IVPWM_IOC_R_SEQ_STATUS			_IOR(IVPWM_IOC_MAGIC,  3, struct ivpwm_seq_status)
+
+#define IVPWM_IOC_MAXNR 3
+
+#endif
@@ -5,31 +5,125 @@
  *    Maxwell Walter (mwalter@iveia.com)
  *
  * Licensed under GPLv2.
+ *
+ * Device tree:
+ *   iveia,npwm              optional, channels in the block, each with its
+ *                           own registers at IVEIA_PWM_STRIDE.  Default 1.
+ *   iveia,double-buffered   optional, the block latches PERIOD and DUTY
+ *                           together at the end of a period, when
+ *                           CONTROL_REG_UPDATE is set.
+ *   reg                     the PWM registers, then optionally the
+ *                           sequencer/capture registers (SEQ_*, CAP_*, each
+ *                           channel at IVEIA_PWM_EXT_STRIDE).  With those,
+ *                           /dev/ivpwmN plays duty cycle sequences (see
+ *                           _pwm-iveia.h).
+ *   iveia,capture           optional, the sequencer/capture registers
+ *                           include capture, for the PWM capture op.
  */
 
 #include <linux/clk.h>
+#include <linux/clocksource.h>
 #include <linux/delay.h>
 #include <linux/err.h>
 #include <linux/io.h>
+#include <linux/iopoll.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/sched/signal.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/pwm.h>
 #include <linux/slab.h>
 
+#include "_pwm-iveia.h"
+
 #define CONTROL_REG         0x00
 #define  CONTROL_REG_ENABLE 0x02
+#define  CONTROL_REG_UPDATE 0x04    // Double-buffered blocks: latch at period end, self clearing
 #define DUTY_REG            0x04
 #define PERIOD_REG          0x08
 #define CLOCK_REG           0x0C
 
+#define IVEIA_PWM_STRIDE    0x10
+#define IVEIA_PWM_MAX_NPWM  16
+
+/*
+ * Sequencer/capture registers
+ */
+#define SEQ_CONTROL_REG         0x00
+#define  SEQ_CONTROL_REG_ENABLE 0x01
+#define  SEQ_CONTROL_REG_FLUSH  0x02    // Self clearing
+#define SEQ_RATE_REG            0x04    // Clock ticks each value is played for
+#define SEQ_FIFO_REG            0x08    // Write to queue a duty cycle, in ticks
+#define SEQ_LEVEL_REG           0x0C
+#define SEQ_DEPTH_REG           0x10
+#define CAP_CONTROL_REG         0x14
+#define  CAP_CONTROL_REG_START  0x01    // Self clearing
+#define  CAP_CONTROL_REG_DONE   0x02
+#define CAP_PERIOD_REG          0x18    // Clock ticks
+#define CAP_DUTY_REG            0x1C    // Clock ticks
+
+#define IVEIA_PWM_EXT_STRIDE    0x20
+#define IVEIA_PWM_WRITE_CHUNK   64
+#define IVEIA_PWM_MAX_SLEEP_US  10000
+
 struct iveia_pwm_chip {
 	struct pwm_chip chip;
 	void __iomem *base;
+	bool double_buffered;
+
+	// Sequencer/capture, if any
+	void __iomem *ext;
+	bool has_capture;
+	struct miscdevice misc;
+	char misc_name[16];
+	struct mutex seq_lock;
+	struct file *seq_owner[IVEIA_PWM_MAX_NPWM];     // Under seq_lock
+
+	// ns -> clock ticks, from CLOCK_REG at probe
+	u64 clock_hz;
+	u32 mult;
+	u32 shift;
+	u64 max_ns;
 };
 
+static inline struct iveia_pwm_chip *to_iveia_pwm(struct pwm_chip *chip)
+{
+	return container_of(chip, struct iveia_pwm_chip, chip);
+}
+
+static inline void __iomem *iveia_pwm_reg(struct iveia_pwm_chip *iveia_pwm,
+					  struct pwm_device *pwm, u32 reg)
+{
+	return iveia_pwm->base + pwm->hwpwm * IVEIA_PWM_STRIDE + reg;
+}
+
+static inline void __iomem *iveia_pwm_ext_reg(struct iveia_pwm_chip *iveia_pwm,
+					      unsigned int channel, u32 reg)
+{
+	return iveia_pwm->ext + channel * IVEIA_PWM_EXT_STRIDE + reg;
+}
+
+/*
+ * max_ns is rounded up and mult to nearest, so at the clamp the product can
+ * be U32_MAX + 1: clamp it too, rather than let it wrap to 0.
+ */
+static u32 iveia_pwm_ns_to_ticks(struct iveia_pwm_chip *iveia_pwm, u64 ns)
+{
+	return min_t(u64, mul_u64_u32_shr(min(ns, iveia_pwm->max_ns), iveia_pwm->mult, iveia_pwm->shift),
+		     U32_MAX);
+}
+
+static u64 iveia_pwm_ticks_to_ns(struct iveia_pwm_chip *iveia_pwm, u32 ticks)
+{
+	return DIV64_U64_ROUND_UP((u64)ticks * NSEC_PER_SEC, iveia_pwm->clock_hz);
+}
+
 
 static const struct of_device_id iveia_pwm_dt_ids[] = {
   { .compatible = "iveia,pl-pwm",},
@@ -37,45 +131,316 @@ static const struct of_device_id iveia_pwm_dt_ids[] = {
 };
 MODULE_DEVICE_TABLE(of, iveia_pwm_dt_ids);
 
+/*
+ * Double-buffered: wait for the last update to be latched, so the new
+ * PERIOD and DUTY can't be latched half written.  Takes up to a period.
+ */
+static int iveia_pwm_wait_update(struct iveia_pwm_chip *iveia_pwm, struct pwm_device *pwm)
+{
+	u32 control;
+	u64 timeout_us = div_u64(pwm->state.period, NSEC_PER_USEC) * 2 + 100;
+
+	return readl_poll_timeout(iveia_pwm_reg(iveia_pwm, pwm, CONTROL_REG), control,
+				  !(control & CONTROL_REG_UPDATE), 1, timeout_us);
+}
+
 static int iveia_pwm_apply(struct pwm_chip *chip, struct pwm_device *pwm,
 			   const struct pwm_state *state)
 {
-        struct iveia_pwm_chip *iveia_pwm = container_of(chip, struct iveia_pwm_chip, chip);
-
-	struct pwm_state cstate;
-	pwm_get_state(pwm, &cstate);
-
-	if (state->enabled) {
-          //TODO: disable when we need to change period
-          u64 pwm_clock = readl(iveia_pwm->base + CLOCK_REG); // PWM input clock in Hz
-          u64 period_reg = (cstate.period * pwm_clock) / 1000000000;
-          u64 duty_reg = (cstate.duty_cycle * pwm_clock) / 1000000000;
-          //dev_info(chip->dev, "apply (%llu) :: %d -> %llu(0x%llX) :: %d -> %llu(0x%llX)\n",
-          //         pwm_clock,
-          //         cstate.period, period_reg, period_reg,
-          //         cstate.duty_cycle, duty_reg, duty_reg);
-          writel((u32)period_reg, iveia_pwm->base + PERIOD_REG);
-          writel((u32)duty_reg, iveia_pwm->base + DUTY_REG);
-          
-          writel(CONTROL_REG_ENABLE, iveia_pwm->base + CONTROL_REG);
-	} else if (cstate.enabled) {
-          // Not enabled, so just leave it be
-          writel(0x0, iveia_pwm->base + CONTROL_REG); // disable        
-        }
+	struct iveia_pwm_chip *iveia_pwm = to_iveia_pwm(chip);
+	u32 period, duty, old_period;
+	int ret;
+
+	if (state->polarity != PWM_POLARITY_NORMAL)
+		return -EINVAL;
+
+	if (!state->enabled) {
+		if (pwm->state.enabled)
+			writel(0x0, iveia_pwm_reg(iveia_pwm, pwm, CONTROL_REG)); // disable
+		return 0;
+	}
+
+	period = iveia_pwm_ns_to_ticks(iveia_pwm, state->period);
+	duty = iveia_pwm_ns_to_ticks(iveia_pwm, min(state->duty_cycle, state->period));
+	if (period == 0)
+		return -EINVAL;
+
+	if (iveia_pwm->double_buffered) {
+		if (pwm->state.enabled) {
+			ret = iveia_pwm_wait_update(iveia_pwm, pwm);
+			if (ret)
+				return ret;
+		}
+		writel(period, iveia_pwm_reg(iveia_pwm, pwm, PERIOD_REG));
+		writel(duty, iveia_pwm_reg(iveia_pwm, pwm, DUTY_REG));
+		writel(CONTROL_REG_ENABLE | CONTROL_REG_UPDATE, iveia_pwm_reg(iveia_pwm, pwm, CONTROL_REG));
+		return 0;
+	}
+
+	/*
+	 * Registers take effect as written: order them so duty never exceeds
+	 * period in between.
+	 */
+	old_period = readl(iveia_pwm_reg(iveia_pwm, pwm, PERIOD_REG));
+	if (period < old_period) {
+		writel(duty, iveia_pwm_reg(iveia_pwm, pwm, DUTY_REG));
+		writel(period, iveia_pwm_reg(iveia_pwm, pwm, PERIOD_REG));
+	} else {
+		writel(period, iveia_pwm_reg(iveia_pwm, pwm, PERIOD_REG));
+		writel(duty, iveia_pwm_reg(iveia_pwm, pwm, DUTY_REG));
+	}
+	if (!pwm->state.enabled)
+		writel(CONTROL_REG_ENABLE, iveia_pwm_reg(iveia_pwm, pwm, CONTROL_REG));
+
+	return 0;
+}
+
+static void iveia_pwm_get_state(struct pwm_chip *chip, struct pwm_device *pwm,
+				struct pwm_state *state)
+{
+	struct iveia_pwm_chip *iveia_pwm = to_iveia_pwm(chip);
+
+	state->enabled = !!(readl(iveia_pwm_reg(iveia_pwm, pwm, CONTROL_REG)) & CONTROL_REG_ENABLE);
+	state->period = iveia_pwm_ticks_to_ns(iveia_pwm, readl(iveia_pwm_reg(iveia_pwm, pwm, PERIOD_REG)));
+	state->duty_cycle = iveia_pwm_ticks_to_ns(iveia_pwm, readl(iveia_pwm_reg(iveia_pwm, pwm, DUTY_REG)));
+	state->polarity = PWM_POLARITY_NORMAL;
+}
+
+static int iveia_pwm_capture(struct pwm_chip *chip, struct pwm_device *pwm,
+			     struct pwm_capture *result, unsigned long timeout)
+{
+	struct iveia_pwm_chip *iveia_pwm = to_iveia_pwm(chip);
+	u32 control;
+	int ret;
+
+	if (!iveia_pwm->has_capture)
+		return -EOPNOTSUPP;
+
+	writel(CAP_CONTROL_REG_START, iveia_pwm_ext_reg(iveia_pwm, pwm->hwpwm, CAP_CONTROL_REG));
+	ret = readl_poll_timeout(iveia_pwm_ext_reg(iveia_pwm, pwm->hwpwm, CAP_CONTROL_REG), control,
+				 control & CAP_CONTROL_REG_DONE, 100, jiffies_to_usecs(timeout));
+	if (ret)
+		return ret;
+
+	result->period = iveia_pwm_ticks_to_ns(iveia_pwm,
+			readl(iveia_pwm_ext_reg(iveia_pwm, pwm->hwpwm, CAP_PERIOD_REG)));
+	result->duty_cycle = iveia_pwm_ticks_to_ns(iveia_pwm,
+			readl(iveia_pwm_ext_reg(iveia_pwm, pwm->hwpwm, CAP_DUTY_REG)));
 
 	return 0;
 }
 
 static const struct pwm_ops iveia_pwm_ops = {
 	.apply = iveia_pwm_apply,
+	.get_state = iveia_pwm_get_state,
+	.capture = iveia_pwm_capture,
+	.owner = THIS_MODULE,
+};
+
+/*
+ * Sequencer char device
+ */
+struct iveia_pwm_file {
+	struct iveia_pwm_chip *iveia_pwm;
+	unsigned int channel;
+};
+
+static void iveia_pwm_seq_stop(struct iveia_pwm_chip *iveia_pwm, unsigned int channel)
+{
+	writel(SEQ_CONTROL_REG_FLUSH, iveia_pwm_ext_reg(iveia_pwm, channel, SEQ_CONTROL_REG));
+	iveia_pwm->seq_owner[channel] = NULL;
+}
+
+static int iveia_pwm_open(struct inode *inode, struct file *filp)
+{
+	struct iveia_pwm_chip *iveia_pwm = container_of(filp->private_data, struct iveia_pwm_chip, misc);
+	struct iveia_pwm_file *pfile;
+
+	pfile = kzalloc(sizeof(*pfile), GFP_KERNEL);
+	if (!pfile)
+		return -ENOMEM;
+	pfile->iveia_pwm = iveia_pwm;
+	filp->private_data = pfile;
+
+	return 0;
+}
+
+static int iveia_pwm_release(struct inode *inode, struct file *filp)
+{
+	struct iveia_pwm_file *pfile = filp->private_data;
+	struct iveia_pwm_chip *iveia_pwm = pfile->iveia_pwm;
+
+	mutex_lock(&iveia_pwm->seq_lock);
+	if (iveia_pwm->seq_owner[pfile->channel] == filp)
+		iveia_pwm_seq_stop(iveia_pwm, pfile->channel);
+	mutex_unlock(&iveia_pwm->seq_lock);
+
+	kfree(pfile);
+	return 0;
+}
+
+/*
+ * Queue duty cycles, in ns, clamped to the channel's period.
+ */
+static ssize_t iveia_pwm_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct iveia_pwm_file *pfile = filp->private_data;
+	struct iveia_pwm_chip *iveia_pwm = pfile->iveia_pwm;
+	struct pwm_device *pwm = &iveia_pwm->chip.pwms[pfile->channel];
+	u32 vals[IVEIA_PWM_WRITE_CHUNK];
+	size_t n = count / sizeof(u32);
+	size_t done = 0;
+	size_t chunk;
+	u32 depth, level, rate;
+	unsigned long sleep_us;
+	ssize_t retval = 0;
+	int i;
+
+	if (count % sizeof(u32) != 0)
+		return -EINVAL;
+
+	while (done < n) {
+		if (mutex_lock_interruptible(&iveia_pwm->seq_lock))
+			return done ? done * sizeof(u32) : -ERESTARTSYS;
+
+		if (iveia_pwm->seq_owner[pfile->channel] != filp) {
+			mutex_unlock(&iveia_pwm->seq_lock);
+			retval = -EPERM;
+			break;
+		}
+
+		depth = readl(iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_DEPTH_REG));
+		level = readl(iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_LEVEL_REG));
+		rate = readl(iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_RATE_REG));
+		chunk = min3((size_t)(depth > level ? depth - level : 0), n - done, (size_t)IVEIA_PWM_WRITE_CHUNK);
+
+		if (chunk) {
+			if (copy_from_user(vals, buf + done * sizeof(u32), chunk * sizeof(u32))) {
+				mutex_unlock(&iveia_pwm->seq_lock);
+				retval = -EFAULT;
+				break;
+			}
+			for (i = 0; i < chunk; i++)
+				writel(iveia_pwm_ns_to_ticks(iveia_pwm, min_t(u64, vals[i], pwm->state.period)),
+				       iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_FIFO_REG));
+			done += chunk;
+		}
+		mutex_unlock(&iveia_pwm->seq_lock);
+
+		if (chunk || done == n)
+			continue;
+
+		// FIFO full: come back when about half of it has been played
+		if (filp->f_flags & O_NONBLOCK) {
+			retval = -EAGAIN;
+			break;
+		}
+		if (signal_pending(current)) {
+			retval = -ERESTARTSYS;
+			break;
+		}
+		sleep_us = min_t(u64, iveia_pwm_ticks_to_ns(iveia_pwm, rate) * (depth / 2 + 1) / NSEC_PER_USEC,
+				 IVEIA_PWM_MAX_SLEEP_US);
+		sleep_us = max(sleep_us, 10UL);
+		usleep_range(sleep_us, sleep_us + sleep_us / 4);
+	}
+
+	return done ? done * sizeof(u32) : retval;
+}
+
+static long iveia_pwm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct iveia_pwm_file *pfile = filp->private_data;
+	struct iveia_pwm_chip *iveia_pwm = pfile->iveia_pwm;
+	struct ivpwm_seq_start start;
+	struct ivpwm_seq_status status;
+	unsigned long channel;
+	long retval = 0;
+
+	if (_IOC_TYPE(cmd) != IVPWM_IOC_MAGIC) return -ENOTTY;
+	if (_IOC_NR(cmd) > IVPWM_IOC_MAXNR) return -ENOTTY;
+	if (!access_ok((void __user *)arg, _IOC_SIZE(cmd))) return -EFAULT;
+
+	if (mutex_lock_interruptible(&iveia_pwm->seq_lock)) return -ERESTARTSYS;
+
+	switch (cmd) {
+	case IVPWM_IOC_W_CHANNEL:
+		__get_user(channel, (unsigned long __user *)arg);
+		if (channel >= iveia_pwm->chip.npwm) {
+			retval = -EINVAL;
+		} else if (iveia_pwm->seq_owner[pfile->channel] == filp) {
+			retval = -EBUSY;
+		} else {
+			pfile->channel = channel;
+		}
+		break;
+
+	case IVPWM_IOC_W_SEQ_START:
+		if (copy_from_user(&start, (void __user *)arg, sizeof(start))) {
+			retval = -EFAULT;
+			break;
+		}
+		if (start.flags || iveia_pwm_ns_to_ticks(iveia_pwm, start.rate_ns) == 0) {
+			retval = -EINVAL;
+			break;
+		}
+		if (!pwm_is_enabled(&iveia_pwm->chip.pwms[pfile->channel])) {
+			retval = -ENOLINK;
+			break;
+		}
+		if (iveia_pwm->seq_owner[pfile->channel] && iveia_pwm->seq_owner[pfile->channel] != filp) {
+			retval = -EBUSY;
+			break;
+		}
+		iveia_pwm->seq_owner[pfile->channel] = filp;
+		writel(SEQ_CONTROL_REG_FLUSH, iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_CONTROL_REG));
+		writel(iveia_pwm_ns_to_ticks(iveia_pwm, start.rate_ns),
+		       iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_RATE_REG));
+		writel(SEQ_CONTROL_REG_ENABLE, iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_CONTROL_REG));
+		break;
+
+	case IVPWM_IOC_SEQ_STOP:
+		if (iveia_pwm->seq_owner[pfile->channel] != filp) {
+			retval = -EPERM;
+			break;
+		}
+		iveia_pwm_seq_stop(iveia_pwm, pfile->channel);
+		break;
+
+	case IVPWM_IOC_R_SEQ_STATUS:
+		memset(&status, 0, sizeof(status));
+		status.running = iveia_pwm->seq_owner[pfile->channel] != NULL;
+		status.level = readl(iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_LEVEL_REG));
+		status.depth = readl(iveia_pwm_ext_reg(iveia_pwm, pfile->channel, SEQ_DEPTH_REG));
+		if (copy_to_user((void __user *)arg, &status, sizeof(status)))
+			retval = -EFAULT;
+		break;
+
+	default:
+		retval = -ENOTTY;
+		break;
+	}
+
+	mutex_unlock(&iveia_pwm->seq_lock);
+	return retval;
+}
+
+static const struct file_operations iveia_pwm_fops = {
 	.owner = THIS_MODULE,
+	.open = iveia_pwm_open,
+	.release = iveia_pwm_release,
+	.write = iveia_pwm_write,
+	.unlocked_ioctl = iveia_pwm_ioctl,
+	.llseek = noop_llseek,
 };
 
 static int iveia_pwm_probe(struct platform_device *pdev)
 {
 	struct iveia_pwm_chip *iveia_pwm;
 	struct resource *res;
+	u32 npwm = 1;
 	int ret;
+	int i;
 
 
         dev_info(&pdev->dev, "probing iVeia PWM\n");
@@ -90,6 +455,39 @@ static int iveia_pwm_probe(struct platform_device *pdev)
           return PTR_ERR(iveia_pwm->base);
         }
 
+	of_property_read_u32(pdev->dev.of_node, "iveia,npwm", &npwm);
+	if (npwm < 1 || npwm > IVEIA_PWM_MAX_NPWM || npwm * IVEIA_PWM_STRIDE > resource_size(res)) {
+		dev_err(&pdev->dev, "invalid iveia,npwm %u\n", npwm);
+		return -EINVAL;
+	}
+	iveia_pwm->double_buffered = of_property_read_bool(pdev->dev.of_node, "iveia,double-buffered");
+
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 1);
+	if (res) {
+		if (npwm * IVEIA_PWM_EXT_STRIDE > resource_size(res)) {
+			dev_err(&pdev->dev, "sequencer registers too small for %u channels\n", npwm);
+			return -EINVAL;
+		}
+		iveia_pwm->ext = devm_ioremap_resource(&pdev->dev, res);
+		if (IS_ERR(iveia_pwm->ext))
+			return PTR_ERR(iveia_pwm->ext);
+		iveia_pwm->has_capture = of_property_read_bool(pdev->dev.of_node, "iveia,capture");
+	}
+	mutex_init(&iveia_pwm->seq_lock);
+
+	/*
+	 * The PWM input clock, in Hz.  All channels share it, and it doesn't
+	 * change, so the ns -> ticks scaling is worked out once.
+	 */
+	iveia_pwm->clock_hz = readl(iveia_pwm->base + CLOCK_REG);
+	if (iveia_pwm->clock_hz == 0) {
+		dev_err(&pdev->dev, "PWM clock reads as 0\n");
+		return -ENODEV;
+	}
+	iveia_pwm->max_ns = iveia_pwm_ticks_to_ns(iveia_pwm, U32_MAX);
+	clocks_calc_mult_shift(&iveia_pwm->mult, &iveia_pwm->shift, NSEC_PER_SEC,
+			       iveia_pwm->clock_hz, div_u64(iveia_pwm->max_ns, NSEC_PER_SEC) + 1);
+
 	iveia_pwm->chip.dev = &pdev->dev;
 	iveia_pwm->chip.ops = &iveia_pwm_ops;
 
@@ -97,9 +495,15 @@ static int iveia_pwm_probe(struct platform_device *pdev)
 		iveia_pwm->chip.of_xlate = of_pwm_xlate_with_flags;
 		iveia_pwm->chip.of_pwm_n_cells = 3;
 	}
-        
+
 	iveia_pwm->chip.base = -1;
-	iveia_pwm->chip.npwm = 1;
+	iveia_pwm->chip.npwm = npwm;
+
+	for (i = 0; i < npwm; i++) {
+		writel(0x0, iveia_pwm->base + i * IVEIA_PWM_STRIDE + CONTROL_REG); // disable
+		if (iveia_pwm->ext)
+			writel(SEQ_CONTROL_REG_FLUSH, iveia_pwm_ext_reg(iveia_pwm, i, SEQ_CONTROL_REG));
+	}
 
 	ret = pwmchip_add(&iveia_pwm->chip);
 	if (ret < 0) {
@@ -109,7 +513,24 @@ static int iveia_pwm_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, iveia_pwm);
 
-        writel(0x0, iveia_pwm->base + CONTROL_REG); // disable        
+	if (iveia_pwm->ext) {
+		snprintf(iveia_pwm->misc_name, sizeof(iveia_pwm->misc_name), "ivpwm%d", iveia_pwm->chip.base);
+		iveia_pwm->misc.minor = MISC_DYNAMIC_MINOR;
+		iveia_pwm->misc.name = iveia_pwm->misc_name;
+		iveia_pwm->misc.fops = &iveia_pwm_fops;
+		iveia_pwm->misc.parent = &pdev->dev;
+		ret = misc_register(&iveia_pwm->misc);
+		if (ret < 0) {
+			dev_err(&pdev->dev, "failed to register %s %d\n", iveia_pwm->misc_name, ret);
+			pwmchip_remove(&iveia_pwm->chip);
+			return ret;
+		}
+	}
+
+	dev_info(&pdev->dev, "%u channels, %llu Hz clock%s%s%s\n", npwm, iveia_pwm->clock_hz,
+		 iveia_pwm->double_buffered ? ", double-buffered" : "",
+		 iveia_pwm->ext ? ", sequencer" : "",
+		 iveia_pwm->has_capture ? ", capture" : "");
 
 	return ret;
 
@@ -119,6 +540,9 @@ static int iveia_pwm_remove(struct platform_device *pdev)
 {
 	struct iveia_pwm_chip *iveia_pwm = platform_get_drvdata(pdev);
 
+	if (iveia_pwm->ext)
+		misc_deregister(&iveia_pwm->misc);
+
 	return pwmchip_remove(&iveia_pwm->chip);
 }
 
@@ -12,9 +12,17 @@
 
 #define DEBUG 1
 
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/gpio/consumer.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
 
@@ -27,18 +35,77 @@
 #define IVPASS_HEIGHT_MIN 480 
 #define IVPASS_HEIGHT_MAX 7760
 
+#define IVPASS_MAX_OUTPUTS 8
+#define IVPASS_MAX_CODES 16
+
+/*
+ * Pads.  Pad 1 is the input; pad 0, and pads 2 through N if the device tree
+ * asks for more than one output, are outputs.  Each output carries the input
+ * unchanged, so one capture can feed several DMA consumers.
+ *
+ * Device tree, all optional:
+ *   iveia,num-outputs   output pads, 1 (default) to IVPASS_MAX_OUTPUTS
+ *   iveia,mbus-codes    supported MEDIA_BUS_FMT_* codes, first is the default
+ *                       (default MEDIA_BUS_FMT_VYYUYY8_1X24)
+ *   iveia,min-size      <width height>, default IVPASS_WIDTH/HEIGHT_MIN
+ *   iveia,max-size      <width height>, default IVPASS_WIDTH/HEIGHT_MAX
+ *   interrupts          a once per frame interrupt from the PL, for the
+ *                       stream statistics.  Must be edge triggered: there
+ *                       is no register to ack it with.
+ */
+#define IVPASS_PAD_SINK 1
+
+#define IVPASS_HIST_BUCKETS 64
+
+static unsigned int hist_bucket_us = 1000;
+module_param(hist_bucket_us, uint, 0644);
+MODULE_PARM_DESC(hist_bucket_us, "Width of the frame interval histogram buckets in us, 0 to not keep a histogram");
+
+/*
+ * Statistics of the current (or last) stream, under stats_lock.  Frames are
+ * counted by the frame interrupt, if there is one.
+ */
+struct ivpass_stats {
+  bool active;
+  u64 start_ns;
+  u64 stop_ns;
+  u64 frames;
+  u64 bytes;
+  u64 dropped;                  // Intervals of 2 or more nominal ones, less 1
+  u64 first_ns;                 // Of the first and last frames
+  u64 last_ns;
+  u64 min_interval_ns;
+  u64 max_interval_ns;
+  u32 hist[IVPASS_HIST_BUCKETS];  // Last bucket is everything longer
+};
 
 struct ivpass_info {
   struct device *dev;
   struct v4l2_subdev subdev;
   
-  // Currently one in / one out
-  struct media_pad pads[2];
+  unsigned int num_pads;
+  struct media_pad pads[IVPASS_MAX_OUTPUTS + 1];
 
-  struct v4l2_mbus_framefmt formats[2];
+  // Active formats, under lock
+  struct mutex lock;
+  struct v4l2_mbus_framefmt formats[IVPASS_MAX_OUTPUTS + 1];
   struct v4l2_mbus_framefmt default_format;
 
-  bool streaming;
+  unsigned int num_codes;
+  u32 codes[IVPASS_MAX_CODES];
+  u32 min_width, min_height;
+  u32 max_width, max_height;
+
+  unsigned int stream_count;     // Outputs streaming, under lock
+  struct v4l2_fract interval;   // Nominal, under lock
+
+  int irq;
+  spinlock_t stats_lock;
+  struct ivpass_stats stats;
+  u64 frame_bytes;              // Of the active format, 0 if unknown
+  u64 interval_ns;              // Nominal
+
+  struct dentry *dbg_dentry;
 };
 
 
@@ -50,51 +117,216 @@ static struct v4l2_subdev_core_ops ivpass_cops = {
   //None
 };
 
+/*
+ * Average bits per pixel of the bus codes we know, for the byte count
+ */
+static unsigned int ivpass_code_bpp(u32 code) {
+  switch (code) {
+  case MEDIA_BUS_FMT_VYYUYY8_1X24:    return 12;
+  case MEDIA_BUS_FMT_VYYUYY10_4X20:   return 15;
+  case MEDIA_BUS_FMT_UYVY8_1X16:
+  case MEDIA_BUS_FMT_YUYV8_1X16:      return 16;
+  case MEDIA_BUS_FMT_UYVY10_1X20:     return 20;
+  case MEDIA_BUS_FMT_RBG888_1X24:
+  case MEDIA_BUS_FMT_RGB888_1X24:
+  case MEDIA_BUS_FMT_VUY8_1X24:       return 24;
+  case MEDIA_BUS_FMT_RGB101010_1X30:
+  case MEDIA_BUS_FMT_VUY10_1X30:      return 30;
+  default:                            return 0;
+  }
+}
+
+/*
+ * Each output's pipeline starts and stops its stream on its own: the stream
+ * (and its statistics) runs from the first start to the last stop.
+ */
 static int ivpass_s_stream(struct v4l2_subdev *subdev, int enable) {
   struct ivpass_info *info = get_info_from_subdev(subdev);
-  dev_dbg(info->dev, "Stream on\n");
+  struct v4l2_mbus_framefmt *format;
+  unsigned long flags;
+  dev_dbg(info->dev, "Stream %s\n", enable ? "on" : "off");
   
-  // Just return true always
+  mutex_lock(&info->lock);
+  if (enable) {
+    if (info->stream_count++ > 0)
+      goto out;
+  } else {
+    if (info->stream_count == 0 || --info->stream_count > 0)
+      goto out;
+  }
+
+  spin_lock_irqsave(&info->stats_lock, flags);
+  if (enable) {
+    format = &info->formats[IVPASS_PAD_SINK];
+    info->frame_bytes = (u64)format->width * format->height * ivpass_code_bpp(format->code) / 8;
+    info->interval_ns = div_u64((u64)info->interval.numerator * NSEC_PER_SEC, info->interval.denominator);
+    memset(&info->stats, 0, sizeof(info->stats));
+    info->stats.active = true;
+    info->stats.start_ns = ktime_get_ns();
+  } else if (info->stats.active) {
+    info->stats.active = false;
+    info->stats.stop_ns = ktime_get_ns();
+  }
+  spin_unlock_irqrestore(&info->stats_lock, flags);
+
+out:
+  mutex_unlock(&info->lock);
+
   return 0;
 }
 
+/*
+ * The frame interval is nominal: the passthrough doesn't set it, but it is
+ * what drops are counted against.
+ */
+static int ivpass_g_frame_interval(struct v4l2_subdev *subdev,
+                                   struct v4l2_subdev_frame_interval *fi) {
+  struct ivpass_info *info = get_info_from_subdev(subdev);
+
+  mutex_lock(&info->lock);
+  fi->interval = info->interval;
+  mutex_unlock(&info->lock);
+
+  return 0;
+}
+
+static int ivpass_s_frame_interval(struct v4l2_subdev *subdev,
+                                   struct v4l2_subdev_frame_interval *fi) {
+  struct ivpass_info *info = get_info_from_subdev(subdev);
+  int ret = 0;
+
+  mutex_lock(&info->lock);
+  if (info->stream_count) {
+    ret = -EBUSY;
+  } else {
+    if (fi->interval.numerator && fi->interval.denominator)
+      info->interval = fi->interval;
+    fi->interval = info->interval;
+  }
+  mutex_unlock(&info->lock);
+
+  return ret;
+}
+
 static struct v4l2_subdev_video_ops ivpass_vops = {
   .s_stream = ivpass_s_stream,
+  .g_frame_interval = ivpass_g_frame_interval,
+  .s_frame_interval = ivpass_s_frame_interval,
 };
 
+static irqreturn_t ivpass_frame_isr(int irq, void *dev_id) {
+  struct ivpass_info *info = dev_id;
+  struct ivpass_stats *stats = &info->stats;
+  u64 now = ktime_get_ns();
+  u64 interval;
+  unsigned int bucket;
+
+  spin_lock(&info->stats_lock);
+  if (!stats->active)
+    goto out;
+
+  if (stats->frames == 0) {
+    stats->first_ns = now;
+  } else {
+    interval = now - stats->last_ns;
+    if (stats->frames == 1 || interval < stats->min_interval_ns)
+      stats->min_interval_ns = interval;
+    stats->max_interval_ns = max(stats->max_interval_ns, interval);
+    if (info->interval_ns && interval >= 2 * info->interval_ns)
+      stats->dropped += div64_u64(interval + info->interval_ns / 2, info->interval_ns) - 1;
+    if (hist_bucket_us) {
+      bucket = min_t(u64, div64_u64(interval, (u64)hist_bucket_us * NSEC_PER_USEC), IVPASS_HIST_BUCKETS - 1);
+      stats->hist[bucket]++;
+    }
+  }
+  stats->last_ns = now;
+  stats->frames++;
+  stats->bytes += info->frame_bytes;
+
+out:
+  spin_unlock(&info->stats_lock);
+  return IRQ_HANDLED;
+}
+
 
+static struct v4l2_mbus_framefmt *ivpass_get_format(struct ivpass_info *info,
+                                                    struct v4l2_subdev_pad_config *cfg,
+                                                    unsigned int pad, u32 which) {
+  if (which == V4L2_SUBDEV_FORMAT_TRY)
+    return v4l2_subdev_get_try_format(&info->subdev, cfg, pad);
+  return &info->formats[pad];
+}
+
+static bool ivpass_code_supported(struct ivpass_info *info, u32 code) {
+  unsigned int i;
+
+  for (i = 0; i < info->num_codes; i++) {
+    if (info->codes[i] == code)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * The input takes any of the supported codes; an output only ever has the
+ * input's.
+ */
 static int ivpass_enum_mbus_code(struct v4l2_subdev *subdev,
                                struct v4l2_subdev_pad_config *cfg,
                                struct v4l2_subdev_mbus_code_enum *code) {
-  struct v4l2_mbus_framefmt *format;
+  struct ivpass_info *info = get_info_from_subdev(subdev);
   
-  if (code->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
-    pr_warn("ivpass: Which is active: %d\n", code->which);
+  if (code->pad >= info->num_pads)
     return -EINVAL;
+
+  if (code->pad == IVPASS_PAD_SINK) {
+    if (code->index >= info->num_codes)
+      return -EINVAL;
+    code->code = info->codes[code->index];
+    return 0;
   }
-  
-  if (code->index) {
-    pr_warn("ivpass: index is %d\n", code->index);
+
+  if (code->index)
     return -EINVAL;
-  }
 
-  // My try_format just passes the format through, so this is basically just
-  //  saying "yes" to every format that gets passed in
-  format = v4l2_subdev_get_try_format(subdev, cfg, code->pad);
-  code->code = format->code;
+  mutex_lock(&info->lock);
+  code->code = ivpass_get_format(info, cfg, IVPASS_PAD_SINK, code->which)->code;
+  mutex_unlock(&info->lock);
   
   return 0;
 }
+
 static int ivpass_enum_frame_size(struct v4l2_subdev *subdev,
-                                  struct v4l2_subdev_pad_config *config,
+                                  struct v4l2_subdev_pad_config *cfg,
                                   struct v4l2_subdev_frame_size_enum *fsize) {
-  // Hard coded for now - limit to the max size of Xilinx framebuffer
-  fsize->min_width =  IVPASS_WIDTH_MIN;
-  fsize->max_width =  IVPASS_WIDTH_MAX;
-  fsize->min_height = IVPASS_HEIGHT_MIN;
-  fsize->max_height = IVPASS_HEIGHT_MAX;
+  struct ivpass_info *info = get_info_from_subdev(subdev);
+  struct v4l2_mbus_framefmt *format;
+  int ret = 0;
+
+  if (fsize->pad >= info->num_pads || fsize->index)
+    return -EINVAL;
+
+  if (fsize->pad == IVPASS_PAD_SINK) {
+    if (!ivpass_code_supported(info, fsize->code))
+      return -EINVAL;
+    fsize->min_width =  info->min_width;
+    fsize->max_width =  info->max_width;
+    fsize->min_height = info->min_height;
+    fsize->max_height = info->max_height;
+    return 0;
+  }
+
+  mutex_lock(&info->lock);
+  format = ivpass_get_format(info, cfg, IVPASS_PAD_SINK, fsize->which);
+  if (fsize->code != format->code) {
+    ret = -EINVAL;
+  } else {
+    fsize->min_width = fsize->max_width = format->width;
+    fsize->min_height = fsize->max_height = format->height;
+  }
+  mutex_unlock(&info->lock);
     
-  return 0;
+  return ret;
 }
 
 static int ivpass_get_fmt(struct v4l2_subdev *subdev,
@@ -102,16 +334,13 @@ static int ivpass_get_fmt(struct v4l2_subdev *subdev,
                           struct v4l2_subdev_format *fmt) {
   struct ivpass_info *info = get_info_from_subdev(subdev);
   
-  switch (fmt->which) {
-  case V4L2_SUBDEV_FORMAT_TRY:
-    fmt->format =  *v4l2_subdev_get_try_format(subdev, cfg, fmt->pad);
-    break;
-  case V4L2_SUBDEV_FORMAT_ACTIVE:
-    fmt->format =  info->formats[fmt->pad];
-    break;
-  default:
-    break;
-  }
+  if (fmt->pad >= info->num_pads)
+    return -EINVAL;
+
+  mutex_lock(&info->lock);
+  fmt->format = *ivpass_get_format(info, cfg, fmt->pad, fmt->which);
+  mutex_unlock(&info->lock);
+
   dev_dbg(info->dev, "Trying to get format to (%d x %d) %d %d %d %d %d :: %d\n",
           fmt->format.width,
           fmt->format.height,
@@ -125,13 +354,42 @@ static int ivpass_get_fmt(struct v4l2_subdev *subdev,
   return 0;
 }
 
+/*
+ * Setting the input's format adjusts it to what is supported and propagates
+ * it to every output.  An output's format can't be set on its own: it gets
+ * the input's.
+ */
 static int ivpass_set_fmt(struct v4l2_subdev *subdev,
                           struct v4l2_subdev_pad_config *cfg,
                           struct v4l2_subdev_format *fmt) {
   struct ivpass_info *info = get_info_from_subdev(subdev);
+  struct v4l2_mbus_framefmt *format;
+  unsigned int pad;
+  int ret = 0;
   
-  clamp_t(unsigned int, fmt->format.width, IVPASS_WIDTH_MIN, IVPASS_WIDTH_MAX);
-  clamp_t(unsigned int, fmt->format.height, IVPASS_HEIGHT_MIN, IVPASS_HEIGHT_MAX);
+  if (fmt->pad >= info->num_pads)
+    return -EINVAL;
+  if (fmt->which != V4L2_SUBDEV_FORMAT_TRY && fmt->which != V4L2_SUBDEV_FORMAT_ACTIVE)
+    return -EINVAL;
+
+  mutex_lock(&info->lock);
+
+  if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE && info->stream_count) {
+    ret = -EBUSY;
+    goto out;
+  }
+
+  if (fmt->pad != IVPASS_PAD_SINK) {
+    fmt->format = *ivpass_get_format(info, cfg, IVPASS_PAD_SINK, fmt->which);
+    goto out;
+  }
+
+  if (!ivpass_code_supported(info, fmt->format.code))
+    fmt->format.code = info->codes[0];
+  fmt->format.width = clamp_t(unsigned int, fmt->format.width, info->min_width, info->max_width);
+  fmt->format.height = clamp_t(unsigned int, fmt->format.height, info->min_height, info->max_height);
+  if (fmt->format.field == V4L2_FIELD_ANY)
+    fmt->format.field = V4L2_FIELD_NONE;
   
   dev_dbg(info->dev, "Trying to set format to (%d x %d) %d %d %d %d %d (pad:%d):: %d\n",
           fmt->format.width,
@@ -144,19 +402,14 @@ static int ivpass_set_fmt(struct v4l2_subdev *subdev,
           fmt->pad,
           fmt->which);
 
-
-  switch(fmt->which) {
-  case V4L2_SUBDEV_FORMAT_TRY:
-    *v4l2_subdev_get_try_format(subdev, cfg, fmt->pad) = fmt->format;
-    break;
-  case V4L2_SUBDEV_FORMAT_ACTIVE:
-    info->formats[fmt->pad] = fmt->format;
-    break;
-  default:
-    return -EINVAL;
+  for (pad = 0; pad < info->num_pads; pad++) {
+    format = ivpass_get_format(info, cfg, pad, fmt->which);
+    *format = fmt->format;
   }
 
-  return 0;
+out:
+  mutex_unlock(&info->lock);
+  return ret;
 }
 
 static struct v4l2_subdev_pad_ops ivpass_pops = {
@@ -176,15 +429,15 @@ static struct v4l2_subdev_ops ivpass_ops = {
 static int ivpass_open(struct v4l2_subdev *subdev, struct v4l2_subdev_fh *fh) {
   struct ivpass_info *info = get_info_from_subdev(subdev);
   struct v4l2_mbus_framefmt *format;
+  unsigned int pad;
 
   dev_dbg(info->dev, "open\n");
 
   // Set to the default format on open
-  format = v4l2_subdev_get_try_format(subdev, fh->pad, 0);
-  *format = info->default_format;
-  
-  format = v4l2_subdev_get_try_format(subdev, fh->pad, 1);
-  *format = info->default_format;
+  for (pad = 0; pad < info->num_pads; pad++) {
+    format = v4l2_subdev_get_try_format(subdev, fh->pad, pad);
+    *format = info->default_format;
+  }
   
   return 0;
 }
@@ -201,10 +454,144 @@ static const struct media_entity_operations ivpass_media_ops = {
 };
 
 
+/*
+ * debugfs: ivpass-<device>/{stats,histogram,reset}
+ */
+static int stats_show(struct seq_file *s, void *unused) {
+  struct ivpass_info *info = s->private;
+  struct ivpass_stats stats;
+  unsigned long flags;
+  u64 end, elapsed;
+
+  spin_lock_irqsave(&info->stats_lock, flags);
+  stats = info->stats;
+  spin_unlock_irqrestore(&info->stats_lock, flags);
+
+  end = stats.active ? ktime_get_ns() : stats.stop_ns;
+  elapsed = stats.start_ns ? end - stats.start_ns : 0;
+
+  seq_printf(s, "streaming: %d\n", stats.active);
+  seq_printf(s, "frame interrupt: %s\n", info->irq > 0 ? "yes" : "no");
+  seq_printf(s, "nominal interval: %u/%u\n", info->interval.numerator, info->interval.denominator);
+  seq_printf(s, "start_ns: %llu\n", stats.start_ns);
+  seq_printf(s, "stop_ns: %llu\n", stats.stop_ns);
+  seq_printf(s, "frames: %llu\n", stats.frames);
+  seq_printf(s, "bytes: %llu\n", stats.bytes);
+  seq_printf(s, "dropped: %llu\n", stats.dropped);
+  seq_printf(s, "min_interval_ns: %llu\n", stats.min_interval_ns);
+  seq_printf(s, "max_interval_ns: %llu\n", stats.max_interval_ns);
+  seq_printf(s, "avg_interval_ns: %llu\n",
+             stats.frames > 1 ? div64_u64(stats.last_ns - stats.first_ns, stats.frames - 1) : 0);
+  seq_printf(s, "fps_x1000: %llu\n", elapsed ? mul_u64_u64_div_u64(stats.frames, 1000 * NSEC_PER_SEC, elapsed) : 0);
+
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static int histogram_show(struct seq_file *s, void *unused) {
+  struct ivpass_info *info = s->private;
+  u32 hist[IVPASS_HIST_BUCKETS];
+  unsigned long flags;
+  int i;
+
+  spin_lock_irqsave(&info->stats_lock, flags);
+  memcpy(hist, info->stats.hist, sizeof(hist));
+  spin_unlock_irqrestore(&info->stats_lock, flags);
+
+  seq_printf(s, "# frame intervals, %u us buckets, last is longer\n", hist_bucket_us);
+  for (i = 0; i < IVPASS_HIST_BUCKETS; i++) {
+    if (hist[i])
+      seq_printf(s, "%u: %u\n", i * hist_bucket_us, hist[i]);
+  }
+
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(histogram);
+
+static int reset_set(void *data, u64 val) {
+  struct ivpass_info *info = data;
+  unsigned long flags;
+
+  spin_lock_irqsave(&info->stats_lock, flags);
+  info->stats.frames = 0;
+  info->stats.bytes = 0;
+  info->stats.dropped = 0;
+  info->stats.first_ns = 0;
+  info->stats.min_interval_ns = 0;
+  info->stats.max_interval_ns = 0;
+  memset(info->stats.hist, 0, sizeof(info->stats.hist));
+  if (info->stats.active)
+    info->stats.start_ns = ktime_get_ns();
+  spin_unlock_irqrestore(&info->stats_lock, flags);
+
+  return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(reset_fops, NULL, reset_set, "%llu\n");
+
+static void ivpass_debugfs_init(struct ivpass_info *info) {
+  char name[64];
+
+  snprintf(name, sizeof(name), "ivpass-%s", dev_name(info->dev));
+  info->dbg_dentry = debugfs_create_dir(name, NULL);
+  debugfs_create_file("stats", 0444, info->dbg_dentry, info, &stats_fops);
+  debugfs_create_file("histogram", 0444, info->dbg_dentry, info, &histogram_fops);
+  debugfs_create_file("reset", 0222, info->dbg_dentry, info, &reset_fops);
+}
+
+
+static int ivpass_parse_dt(struct ivpass_info *info) {
+  struct device_node *node = info->dev->of_node;
+  u32 num_outputs = 1;
+  u32 size[2];
+  int ret;
+
+  of_property_read_u32(node, "iveia,num-outputs", &num_outputs);
+  if (num_outputs < 1 || num_outputs > IVPASS_MAX_OUTPUTS) {
+    dev_err(info->dev, "invalid iveia,num-outputs %u\n", num_outputs);
+    return -EINVAL;
+  }
+  info->num_pads = num_outputs + 1;
+
+  ret = of_property_read_variable_u32_array(node, "iveia,mbus-codes", info->codes, 1, IVPASS_MAX_CODES);
+  if (ret == -EINVAL) {
+    info->codes[0] = MEDIA_BUS_FMT_VYYUYY8_1X24;
+    info->num_codes = 1;
+  } else if (ret < 0) {
+    dev_err(info->dev, "invalid iveia,mbus-codes\n");
+    return ret;
+  } else {
+    info->num_codes = ret;
+  }
+
+  info->min_width = IVPASS_WIDTH_MIN;
+  info->min_height = IVPASS_HEIGHT_MIN;
+  if (of_property_read_u32_array(node, "iveia,min-size", size, 2) == 0) {
+    info->min_width = size[0];
+    info->min_height = size[1];
+  }
+  info->max_width = IVPASS_WIDTH_MAX;
+  info->max_height = IVPASS_HEIGHT_MAX;
+  if (of_property_read_u32_array(node, "iveia,max-size", size, 2) == 0) {
+    info->max_width = size[0];
+    info->max_height = size[1];
+  }
+  if (info->min_width == 0 || info->min_height == 0
+      || info->min_width > info->max_width || info->min_height > info->max_height) {
+    dev_err(info->dev, "invalid iveia,min-size/max-size\n");
+    return -EINVAL;
+  }
+
+  dev_info(info->dev, "%u outputs, %u codes, %ux%u to %ux%u\n", num_outputs, info->num_codes,
+           info->min_width, info->min_height, info->max_width, info->max_height);
+
+  return 0;
+}
+
 static int ivpass_probe(struct platform_device *pdev) {
   struct ivpass_info *info;
   struct v4l2_subdev *subdev;
-  u32 ret;
+  unsigned int i;
+  int ret;
 
   info = devm_kzalloc(&pdev->dev, sizeof(*info), GFP_KERNEL);
   if(!info) {
@@ -214,16 +601,40 @@ static int ivpass_probe(struct platform_device *pdev) {
 
   dev_warn(&pdev->dev, "probing iVeia passthrough driver\n");
 
+  ret = ivpass_parse_dt(info);
+  if (ret < 0)
+    return ret;
+  mutex_init(&info->lock);
+  spin_lock_init(&info->stats_lock);
+  info->interval.numerator = 1;
+  info->interval.denominator = 30;
+
+  info->irq = platform_get_irq_optional(pdev, 0);
+  if (info->irq == -EPROBE_DEFER)
+    return info->irq;
+  if (info->irq > 0 && !(irq_get_trigger_type(info->irq) & IRQ_TYPE_EDGE_BOTH)) {
+    dev_warn(&pdev->dev, "frame interrupt is not edge triggered, not using it\n");
+    info->irq = 0;
+  }
+  if (info->irq > 0) {
+    ret = devm_request_irq(&pdev->dev, info->irq, ivpass_frame_isr, 0, dev_name(&pdev->dev), info);
+    if (ret < 0) {
+      dev_err(&pdev->dev, "failed to request frame interrupt\n");
+      return ret;
+    }
+  }
+
   // Use Xilinx' defaults here (just because)
-  info->default_format.code = MEDIA_BUS_FMT_VYYUYY8_1X24;
+  info->default_format.code = info->codes[0];
+  info->default_format.width = info->min_width;
+  info->default_format.height = info->min_height;
   info->default_format.field = V4L2_FIELD_NONE;
   info->default_format.colorspace = V4L2_COLORSPACE_REC709;
 
-  // Currently, pad0 is input, pad1 though padN is output
-  info->pads[0].flags = MEDIA_PAD_FL_SOURCE;
-  info->formats[0] = info->default_format;
-  info->pads[1].flags = MEDIA_PAD_FL_SINK;
-  info->formats[1] = info->default_format;
+  for (i = 0; i < info->num_pads; i++) {
+    info->pads[i].flags = i == IVPASS_PAD_SINK ? MEDIA_PAD_FL_SINK : MEDIA_PAD_FL_SOURCE;
+    info->formats[i] = info->default_format;
+  }
 
   subdev = &info->subdev;
   v4l2_subdev_init(subdev, &ivpass_ops);
@@ -234,7 +645,7 @@ static int ivpass_probe(struct platform_device *pdev) {
   subdev->flags |= V4L2_SUBDEV_FL_HAS_DEVNODE;
   subdev->entity.ops = &ivpass_media_ops;
 
-  ret = media_entity_pads_init(&subdev->entity, 2, info->pads);
+  ret = media_entity_pads_init(&subdev->entity, info->num_pads, info->pads);
   if (ret < 0) {
     dev_dbg(&pdev->dev, "Failed to init media pads\n");
     goto error;
@@ -248,6 +659,8 @@ static int ivpass_probe(struct platform_device *pdev) {
     goto error;
   }
 
+  ivpass_debugfs_init(info);
+
   return 0;
 
 error:
@@ -259,8 +672,10 @@ static int ivpass_remove(struct platform_device *pdev) {
   struct ivpass_info *info = platform_get_drvdata(pdev);
   struct v4l2_subdev *subdev = &info->subdev;
   
+  debugfs_remove_recursive(info->dbg_dentry);
   v4l2_async_unregister_subdev(subdev);
   media_entity_cleanup(&subdev->entity);
+  mutex_destroy(&info->lock);
   
   return 0;
 }
@@ -7,6 +7,10 @@
 #endif
 #include <linux/ioctl.h>
 #include <linux/fcntl.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
 #include "zap.h"
 #include "pool.h"
 
@@ -14,6 +18,8 @@
 
 #define ZAP_MAX_DEVICES 16
 
+struct dma_if;
+
 struct zap_fpga_parameters {
     int num_interfaces;
 
@@ -30,6 +36,19 @@ struct zap_fpga_parameters {
 	char fpga_version_release;
 };
 
+// A buffer forwarded from an RX pool, queued for TX (see fwd.c)
+struct zap_fwd_desc {
+	void * pbuf;
+	unsigned long len;
+	unsigned long ooblen;
+	int src;		// RX interface whose pool pbuf belongs to
+};
+
+#define ZAP_FWD_RING_SIZE 256
+
+struct socket;
+struct zap_dev;
+
 struct zap_if {
 	struct semaphore in_use_rx;
 	struct semaphore in_use_tx;
@@ -53,10 +72,31 @@ struct zap_if {
 	unsigned long tx_header_enable;
 	unsigned long rx_jumbo_pkt_enable;
 	unsigned long tx_jumbo_pkt_enable;
+
+	unsigned long cpu_affinity;
+
+	// Forwarding of this interface's RX packets (see fwd.c)
+	struct zap_dev * fwd_dev;
+	spinlock_t fwd_lock;
+	int fwd_mode;
+	int fwd_target;
+	struct socket * fwd_sock;
+	void * fwd_vaddr;
+	struct work_struct fwd_work;
+	atomic_long_t fwd_count;	// From the ISR and the socket worker
+	atomic_long_t fwd_drops;
+	atomic_t fwd_outstanding;	// Buffers queued to or on a target's TX
+
+	// Buffers forwarded to this interface's TX: queued, then handed to TX
+	// DMA, in order, until TX_FREE returns them.
+	spinlock_t fwd_tx_lock;
+	DECLARE_KFIFO(fwd_ring, struct zap_fwd_desc, ZAP_FWD_RING_SIZE);
+	DECLARE_KFIFO(fwd_inflight, struct zap_fwd_desc, ZAP_FWD_RING_SIZE);
 };
 
 struct zap_dev {
     struct device *dev;
+    int instance;
     u32 num_devices;
 	struct cdev cdev;
     dev_t node;
@@ -79,6 +119,10 @@ struct zap_dev {
 
     //Variables per interface
     struct zap_if *interface;
+
+    //DMA engine state, owned by dma.c / dma_*.c
+    struct semaphore dma_sem;
+    struct dma_if *dma_if;
 };
 
 
@@ -13,25 +13,12 @@
 #include <linux/timer.h>
 #include <linux/delay.h>
 #include <linux/semaphore.h>
+#include <linux/device.h>
 #include <asm/io.h>
 
 #include "_zap.h"
 #include "dma.h"
 
-///////////////////////////////////////////////////////////////////////////
-//
-// Globals
-//
-///////////////////////////////////////////////////////////////////////////
-
-struct dma {
-	struct zap_dev * zap_dev;
-	struct semaphore sem;
-};
-
-struct dma dma;
-struct dma * pdma = &dma;
-
 ///////////////////////////////////////////////////////////////////////////
 //
 // Private funcs
@@ -45,40 +32,42 @@ struct dma * pdma = &dma;
 //
 static int
 dma_start_rx_unsafe(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	int err = 0;
 
-	err = pool_flush( &pdma->zap_dev->interface[iDevice].rx_pool );
+	err = pool_flush( &dev->interface[iDevice].rx_pool );
 	if ( err ) 
         return err;
 
-	err = pool_busy( &pdma->zap_dev->interface[iDevice].rx_pool );
+	err = pool_busy( &dev->interface[iDevice].rx_pool );
 	if ( err ) 
         return err;
 
-	dma_ll_start_rx(iDevice);
+	dma_ll_start_rx(dev, iDevice);
 
 	return err;
 }
 
 static int
 dma_start_tx_unsafe(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	int err = 0;
 
-	err = pool_flush( &pdma->zap_dev->interface[iDevice].tx_pool );
+	err = pool_flush( &dev->interface[iDevice].tx_pool );
 	if ( err ) 
         return err;
 
-	err = pool_busy( &pdma->zap_dev->interface[iDevice].tx_pool );
+	err = pool_busy( &dev->interface[iDevice].tx_pool );
 	if ( err ) 
         return err;
 
-	dma_ll_start_tx(iDevice);
+	dma_ll_start_tx(dev, iDevice);
 
 	return err;
 }
@@ -86,24 +75,26 @@ dma_start_tx_unsafe(
 
 static int
 dma_stop_rx_unsafe(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	// Shut off DMA.  This will cause workqueues to stop.
 
-	dma_ll_stop_rx(iDevice);
+	dma_ll_stop_rx(dev, iDevice);
 
 	return 0;
 }
 
 static int
 dma_stop_tx_unsafe(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	// Shut off DMA.  This will cause workqueues to stop.
 
-	dma_ll_stop_tx(iDevice);
+	dma_ll_stop_tx(dev, iDevice);
 
 	return 0;
 }
@@ -126,79 +117,177 @@ dma_init(
 {
 	int err;
 
+	sema_init( &dev->dma_sem , 1);
+
 	err = dma_ll_init(dev, rx_pool_paddr, rx_pool_size, 
             tx_pool_paddr, tx_pool_size);
 	if (err)
 		return err;
 
-	pdma->zap_dev = dev;
-
-	sema_init( &pdma->sem , 1);
-
 	return 0;
 }
 
 
 int 
 dma_cleanup(
-	int iNumPorts
+	struct zap_dev * dev
 	)
 {
 	int err;
 	int i;
 
-    for (i = 0; i < iNumPorts; i++) {
-	    err = dma_stop_rx(i);
+	if ( !dev->dma_if )
+		return 0;
+
+    for (i = 0; i < dev->num_devices; i++) {
+	    err = dma_stop_rx(dev, i);
 	    if ( err ) 
             return err;
 
-	    err = dma_stop_tx(i);
+	    err = dma_stop_tx(dev, i);
 	    if ( err ) 
             return err;
     }
 
-	dma_ll_cleanup();
+	dma_ll_cleanup(dev);
 
 	return 0;
 }
 
 
+//
+// Pick up a new bitstream without reloading the module.  All running
+// interfaces are stopped, the FPGA parameters re-read, and the interfaces
+// that were running restarted with their pools flushed in place.  The pools
+// (and so any existing mmaps) are only kept if the new bitstream has the same
+// number of interfaces; if it does not, nothing may be open, and with
+// something open it fails with -EBUSY.  It fails too, with all interfaces
+// left stopped, if an interface can't be stopped cleanly, or if the new
+// bitstream has more interfaces than num-devices.
+//
+int
+dma_reconfigure(
+	struct zap_dev * dev
+	)
+{
+	struct zap_fpga_parameters params;
+	int rx_on[ZAP_MAX_DEVICES];
+	int tx_on[ZAP_MAX_DEVICES];
+	int err = 0;
+	int ret;
+	int i;
+
+	if ( down_interruptible( &dev->dma_sem )) 
+        return -ERESTARTSYS;
+
+	for (i = 0; i < dev->num_devices; i++) {
+		rx_on[i] = dma_ll_rx_is_on(dev, i);
+		tx_on[i] = dma_ll_tx_is_on(dev, i);
+		// Unlike a restart, a failed stop (e.g. a buffer still held by
+		// userspace) fails the reconfigure
+		if ( rx_on[i] ) {
+			ret = dma_ll_stop_rx(dev, i);
+			err = err ? err : ret;
+		}
+		if ( tx_on[i] ) {
+			ret = dma_ll_stop_tx(dev, i);
+			err = err ? err : ret;
+		}
+	}
+	if ( err ) {
+		dev_err(dev->dev, "reconfig: stopping DMA failed (%d), left stopped\n", err);
+		up( &dev->dma_sem );
+		return err;
+	}
+
+	dma_ll_reread_fpga_parameters(dev, &params);
+
+	if (params.num_interfaces > dev->num_devices) {
+		dev_err(dev->dev, "reconfig: %d interfaces, only %u supported\n",
+			params.num_interfaces, dev->num_devices);
+		up( &dev->dma_sem );
+		return -EINVAL;
+	}
+
+	if (params.num_interfaces != dev->fpga_params.num_interfaces && dev->open_count > 0) {
+		dev_err(dev->dev, "reconfig: interface count changed (%d -> %d) with devices open\n",
+			dev->fpga_params.num_interfaces, params.num_interfaces);
+		// The old geometry doesn't describe the new bitstream: leave DMA off
+		up( &dev->dma_sem );
+		return -EBUSY;
+	}
+
+	dev->fpga_params = params;
+	dev_info(dev->dev, "reconfig: FPGA v%d_%d_%c, %d interface(s)\n",
+		params.fpga_version_major, params.fpga_version_minor,
+		params.fpga_version_release, params.num_interfaces);
+
+	for (i = 0; i < dev->fpga_params.num_interfaces; i++) {
+		if ( rx_on[i] ) {
+			if ( dev->interface[i].rx_payload_max_size - 
+					(dev->interface[i].rx_header_enable ? dev->interface[i].rx_header_size : 0) >
+					dev->fpga_params.rx_dat_fifo_size && ! dev->interface[i].rx_jumbo_pkt_enable ) {
+				dev_err(dev->dev, "reconfig: rx%d max size exceeds new FIFO, left stopped\n", i);
+				err = -EFBIG;
+			} else if ( dma_start_rx_unsafe(dev, i) ) {
+				err = -EIO;
+			}
+		}
+		if ( tx_on[i] ) {
+			if ( dev->interface[i].tx_payload_max_size - 
+					(dev->interface[i].tx_header_enable ? dev->interface[i].tx_header_size : 0) >
+					dev->fpga_params.tx_dat_fifo_size && ! dev->interface[i].tx_jumbo_pkt_enable ) {
+				dev_err(dev->dev, "reconfig: tx%d max size exceeds new FIFO, left stopped\n", i);
+				err = -EFBIG;
+			} else if ( dma_start_tx_unsafe(dev, i) ) {
+				err = -EIO;
+			}
+		}
+	}
+
+	up( &dev->dma_sem );
+
+	return err;
+}
+
 int 
 dma_start_rx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	int err;
 
-	if ( down_interruptible( &pdma->sem )) 
+	if ( down_interruptible( &dev->dma_sem )) 
         return -ERESTARTSYS;
 
-	err = dma_stop_rx_unsafe(iDevice);
+	err = dma_stop_rx_unsafe(dev, iDevice);
 	if ( ! err ) {
-		err = dma_start_rx_unsafe(iDevice);
+		err = dma_start_rx_unsafe(dev, iDevice);
 	}
 
-	up( &pdma->sem );
+	up( &dev->dma_sem );
 
 	return err;
 }
 
 int 
 dma_start_tx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	int err;
 
-	if ( down_interruptible( &pdma->sem )) 
+	if ( down_interruptible( &dev->dma_sem )) 
         return -ERESTARTSYS;
 
-	err = dma_stop_tx_unsafe(iDevice);
+	err = dma_stop_tx_unsafe(dev, iDevice);
 	if ( ! err ) {
-		err = dma_start_tx_unsafe(iDevice);
+		err = dma_start_tx_unsafe(dev, iDevice);
 	}
 
-	up( &pdma->sem );
+	up( &dev->dma_sem );
 
 	return err;
 }
@@ -206,34 +295,36 @@ dma_start_tx(
 
 int 
 dma_stop_rx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	int err;
 
-	if ( down_interruptible( &pdma->sem )) 
+	if ( down_interruptible( &dev->dma_sem )) 
         return -ERESTARTSYS;
 
-	err = dma_stop_rx_unsafe(iDevice);
+	err = dma_stop_rx_unsafe(dev, iDevice);
 
-	up( &pdma->sem );
+	up( &dev->dma_sem );
 
 	return err;
 }
 
 int 
 dma_stop_tx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
 	int err;
 
-	if ( down_interruptible( &pdma->sem )) 
+	if ( down_interruptible( &dev->dma_sem )) 
         return -ERESTARTSYS;
 
-	err = dma_stop_tx_unsafe(iDevice);
+	err = dma_stop_tx_unsafe(dev, iDevice);
 
-	up( &pdma->sem );
+	up( &dev->dma_sem );
 
 	return err;
 }
@@ -241,17 +332,19 @@ dma_stop_tx(
 
 int 
 dma_rx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
-	return dma_ll_rx_is_on(iDevice);
+	return dma_ll_rx_is_on(dev, iDevice);
 }
 
 int 
 dma_tx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
-	return dma_ll_tx_is_on(iDevice);
+	return dma_ll_tx_is_on(dev, iDevice);
 }
 
@@ -32,36 +32,47 @@ dma_init(
 
 int 
 dma_cleanup(
-	int iNumPorts
+	struct zap_dev * dev
+	);
+
+int
+dma_reconfigure(
+	struct zap_dev * dev
 	);
 
 int 
 dma_start_rx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int 
 dma_start_tx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int 
 dma_stop_rx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int 
 dma_stop_tx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int 
 dma_rx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int 
 dma_tx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
@@ -71,21 +82,25 @@ dma_tx_is_on(
 
 int
 dma_ll_start_rx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int
 dma_ll_start_tx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int
 dma_ll_stop_rx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int
 dma_ll_stop_tx(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
@@ -100,39 +115,70 @@ dma_ll_init(
 
 int 
 dma_ll_cleanup(
-	void
+	struct zap_dev * dev
 	);
 
 int 
 dma_ll_rx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 int 
 dma_ll_tx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 void
 dma_ll_rx_free_buf(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 void
 dma_ll_tx_write_buf(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
 void
 dma_ll_update_high_water_marks(
+	struct zap_dev * dev,
 	int iDevice
 	);
 
-int dma_ll_rx_dma_count(int iDevice);
+int dma_ll_rx_dma_count(struct zap_dev * dev, int iDevice);
 
-int dma_ll_tx_dma_count(int iDevice);
+int dma_ll_tx_dma_count(struct zap_dev * dev, int iDevice);
+
+unsigned long dma_ll_mmio_ops(struct zap_dev * dev, int iDevice);
+
+void dma_ll_reset_mmio_ops(struct zap_dev * dev, int iDevice);
 
 void
-dma_ll_update_fpga_parameters(void);
+dma_ll_update_fpga_parameters(
+	struct zap_dev * dev,
+	int force
+	);
+
+void
+dma_ll_reread_fpga_parameters(
+	struct zap_dev * dev,
+	struct zap_fpga_parameters * p
+	);
+
+int
+dma_ll_set_cpu_affinity(
+	struct zap_dev * dev,
+	int iDevice,
+	unsigned long cpu_mask
+	);
+
+int
+dma_ll_cpu_placement(
+	struct zap_dev * dev,
+	int iDevice
+	);
 
 #endif
@@ -18,6 +18,7 @@
 #include <linux/dma-mapping.h>
 #include <linux/mm.h>
 #include <linux/irq.h>
+#include <linux/cpumask.h>
 
 #include <linux/of.h>
 #include <linux/irq.h>
@@ -25,9 +26,7 @@
 
 #include "_zap.h"
 #include "dma.h"
-
-
-extern struct zap_dev * zap_devp;
+#include "fwd.h"
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -96,76 +95,145 @@ extern struct zap_dev * zap_devp;
 	#define FPGA_VERSION_MINOR_SHIFT	8
 	#define FPGA_VERSION_RELEASE_SHIFT	0
 
-#define _ZAP_REG_READ(reg)			\
-	ioread32(&pdma_if->zap_reg[reg])
-#define _ZAP_REG_WRITE(reg, val)			\
-	iowrite32(val,&pdma_if->zap_reg[reg])
-#define _ZAP_REG_WRITE_MASKED(reg, val, mask)	\
-	_ZAP_REG_WRITE( reg, (val & mask) | (_ZAP_REG_READ(reg) & ~mask))
+#define ZAP_IF_REG_STRIDE	0x00000020
 
 #define ZAP_POOL_MIN_SIZE  (0 * 1024 * 1024)
 
-spinlock_t lock2;
+#define ZAP_RX_REFILL_BATCH	16
 
 struct dma_if_interface {
+	struct dma_if * owner;
     int iDevice;
 	int rx_on, tx_on;
 	int rx_dma_count, tx_dma_count;
+	int cpu;	// CPU for the RX refill worker, or WORK_CPU_UNBOUND
+	char __iomem * regs;	// This interface's register window
+	atomic_long_t mmio_ops;	// From the ISR and process context
 	struct workqueue_struct * prx_workqueue;
     struct work_struct rx_work;
 };
 
 struct dma_if {
 	struct zap_dev * zap_dev;
-	char * zap_reg;
+	char __iomem * zap_reg;
+	spinlock_t reg_lock;	// Serializes read-modify-write of shared registers
+	int fpga_params_valid;
 	int irq;
 	phys_addr_t rx_buffer_paddr;
 	phys_addr_t tx_buffer_paddr;
 	unsigned long rx_buffer_size;
 	unsigned long tx_buffer_size;
 
+	// Union of the CPUs chosen by each interface.  The ZAP core has a single
+	// IRQ line for all interfaces, so this is the best we can pin it to.
+	struct cpumask irq_affinity;
+
     struct dma_if_interface *interface;
 };
 
-struct dma_if dma_if;
-struct dma_if * pdma_if = &dma_if;
+///////////////////////////////////////////////////////////////////////////
+//
+// Register access
+//
+// Each interface's register window is resolved once, at init.  Descriptor
+// writes are posted with relaxed accessors, and only the write that hands a
+// buffer to the FPGA (the doorbell) carries a barrier, ordering it after the
+// CPU's accesses to that buffer.  Every access is counted in the interface's
+// mmio_ops, so the cost per packet can be measured from userspace.
+//
+///////////////////////////////////////////////////////////////////////////
 
-uint32_t VSOC_ZAP_REG_READ(uint32_t reg) {
-    //printk("ZAP_REG_READ %08X, %08X, %08X\n", reg, 0, 0);
-	uint32_t ulRetVal;
-	unsigned long irqflags;
-	spin_lock_irqsave( &lock2, irqflags );
-	ulRetVal = _ZAP_REG_READ(reg);
-	spin_unlock_irqrestore( &lock2, irqflags );
-	return ulRetVal;
+static inline uint32_t
+zap_reg_read(
+	struct dma_if_interface * pif,
+	uint32_t reg
+	)
+{
+	atomic_long_inc(&pif->mmio_ops);
+	return readl_relaxed(pif->regs + reg);
 }
 
-void VSOC_ZAP_REG_WRITE(uint32_t reg, uint32_t val) {
-    //printk("ZAP_REG_WRITE %08X, %08X, %08X\n", reg, val, 0);
-	unsigned long irqflags;
-	spin_lock_irqsave( &lock2, irqflags );
-	_ZAP_REG_WRITE(reg, val);
-	spin_unlock_irqrestore( &lock2, irqflags );
+static inline void
+zap_reg_post(
+	struct dma_if_interface * pif,
+	uint32_t reg,
+	uint32_t val
+	)
+{
+	atomic_long_inc(&pif->mmio_ops);
+	writel_relaxed(val, pif->regs + reg);
 }
-void VSOC_ZAP_REG_WRITE_MASKED(uint32_t reg, uint32_t val, uint32_t mask) {
-    //printk("ZAP_REG_WRITE_MASKED %08X, %08X, %08X\n", reg, val, mask);
-	unsigned long irqflags;
-	spin_lock_irqsave( &lock2, irqflags );
-	_ZAP_REG_WRITE_MASKED(reg, val, mask);
-	spin_unlock_irqrestore( &lock2, irqflags );
+
+static inline void
+zap_reg_doorbell(
+	struct dma_if_interface * pif,
+	uint32_t reg,
+	uint32_t val
+	)
+{
+	atomic_long_inc(&pif->mmio_ops);
+	writel(val, pif->regs + reg);
 }
 
+//
+// Reset one direction of an interface: drop the enable bit with the new mode
+// bits in place, then raise it again.  One CSR read instead of one per bit.
+//
+static void
+zap_csr_restart(
+	struct dma_if_interface * pif,
+	uint32_t enable,
+	uint32_t mode_mask,
+	uint32_t mode
+	)
+{
+	unsigned long irqflags;
+	uint32_t csr;
 
-uint32_t ZAP_REG_READ(int iDevice, uint32_t reg){
-    return VSOC_ZAP_REG_READ(iDevice * 0x00000020 + reg);
+	spin_lock_irqsave( &pif->owner->reg_lock, irqflags );
+	csr = zap_reg_read(pif, ZAP_REG_CSR);
+	csr = (csr & ~(enable | mode_mask)) | mode;
+	zap_reg_post(pif, ZAP_REG_CSR, csr);
+	udelay(1);
+	zap_reg_post(pif, ZAP_REG_CSR, csr | enable);
+	spin_unlock_irqrestore( &pif->owner->reg_lock, irqflags );
 }
 
-void ZAP_REG_WRITE(int iDevice, uint32_t reg, uint32_t val){
-    VSOC_ZAP_REG_WRITE(iDevice * 0x00000020 + reg, val);
+//
+// Registers of the shared window (interrupt status, FPGA parameters), not
+// tied to an interface.
+//
+static inline uint32_t
+zap_core_read(
+	struct dma_if * pdma_if,
+	uint32_t reg
+	)
+{
+	return readl_relaxed(pdma_if->zap_reg + reg);
+}
+
+static inline void
+zap_core_write(
+	struct dma_if * pdma_if,
+	uint32_t reg,
+	uint32_t val
+	)
+{
+	writel(val, pdma_if->zap_reg + reg);
 }
 
-void ZAP_REG_WRITE_MASKED(int iDevice, uint32_t reg, uint32_t val, uint32_t mask){
-    VSOC_ZAP_REG_WRITE_MASKED(iDevice * 0x00000020 + reg, val, mask);
+// Clear bits of an interface's CSR.
+static void
+zap_csr_clear(
+	struct dma_if_interface * pif,
+	uint32_t bits
+	)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave( &pif->owner->reg_lock, irqflags );
+	zap_reg_post(pif, ZAP_REG_CSR, zap_reg_read(pif, ZAP_REG_CSR) & ~bits);
+	spin_unlock_irqrestore( &pif->owner->reg_lock, irqflags );
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -175,16 +243,21 @@ void ZAP_REG_WRITE_MASKED(int iDevice, uint32_t reg, uint32_t val, uint32_t mask
 ///////////////////////////////////////////////////////////////////////////
 
 //
-// Append a buffer descriptor to the tail of the BD ring.
+// Hand a batch of free buffers to the RX FIFO.  The RBAR writes are posted
+// back-to-back behind a single barrier.
 //
-void
-dma_ll_put_rx(
-    int iDevice,
-	phys_addr_t pbuf, 
-	unsigned long len 
+static void
+dma_ll_put_rx_batch(
+	struct dma_if_interface * pif,
+	void ** pbufs,
+	int num
 	)
 {
-	ZAP_REG_WRITE(iDevice, ZAP_REG_RBAR, (uint32_t) pbuf);
+	int i;
+
+	wmb();
+	for (i = 0; i < num; i++)
+		zap_reg_post(pif, ZAP_REG_RBAR, (uint32_t)(uintptr_t)pbufs[i]);
 }
 
 
@@ -207,27 +280,36 @@ dma_rx_task(
 	struct work_struct * work
 	)
 {
-	void * pbuf;
+	void * pbufs[ZAP_RX_REFILL_BATCH];
 	unsigned long len;
+	int num;
 	int err;
     struct dma_if_interface * pdma_if_interface;
+	struct dma_if * pdma_if;
     int iDevice;
+	struct pool * ppool;
 
     pdma_if_interface = container_of(work, struct dma_if_interface, rx_work);
     iDevice = pdma_if_interface->iDevice;
+	pdma_if = pdma_if_interface->owner;
+	ppool = &pdma_if->zap_dev->interface[iDevice].rx_pool;
 
     //printk(KERN_ERR "ENTERED DMA_RX_TASK, iDevice = %d\n",iDevice);
 
 	while ( pdma_if->interface[iDevice].rx_on ) {
 		do {
-			err = pool_getbuf_timeout( 
-				&pdma_if->zap_dev->interface[iDevice].rx_pool, &pbuf, &len, HZ/2 );
+			err = pool_getbuf_timeout( ppool, &pbufs[0], &len, HZ/2 );
 		} while ( err == -EAGAIN && pdma_if->interface[iDevice].rx_on );
 
 		if ( err ) {
 			pdma_if->interface[iDevice].rx_on = 0;
 		} else {
-			dma_ll_put_rx( iDevice, (phys_addr_t)pbuf, len );
+			// Pick up whatever else is free without blocking
+			for ( num = 1; num < ZAP_RX_REFILL_BATCH; num++ ) {
+				if ( ! pool_getbuf_try( ppool, &pbufs[num], &len ))
+					break;
+			}
+			dma_ll_put_rx_batch( pdma_if_interface, pbufs, num );
 		}
 	}
 }
@@ -273,6 +355,8 @@ dma_isr(
 	void * dev_id
 	)
 {
+	struct zap_dev * dev = dev_id;
+	struct dma_if * pdma_if = dev->dma_if;
 	int err;
 	int iRetVal;
 	uint32_t len = 0;
@@ -282,6 +366,7 @@ dma_isr(
 	void * pbuf;
 	uint32_t icr;
     int iDevice;
+	struct dma_if_interface * pif;
 
     unsigned long ulLen, ulOoblen;
 
@@ -292,7 +377,7 @@ dma_isr(
 	// Ack interrupt, a writeback will ack all pending intr bits.
 	//
 	//icr = ZAP_REG_READ(ZAP_REG_ICR);
-    icr = ZAP_REG_READ(0,ZAP_REG_ISR);
+    icr = zap_core_read(pdma_if, ZAP_REG_ISR);
     iDevice = (int)((icr >> 8) & 0x000000ff);
     //iDevice = 1;
 
@@ -303,11 +388,18 @@ dma_isr(
 		printk(KERN_ERR MODNAME ": ZAP DMA spurous interrupt (ICR: %08X)", icr);
 		return IRQ_HANDLED;
 	}
+
+	if (iDevice >= dev->num_devices) {
+		printk(KERN_ERR MODNAME ": ZAP DMA interrupt for bad interface (ICR: %08X)", icr);
+		return IRQ_HANDLED;
+	}
+	pif = &pdma_if->interface[iDevice];
+	atomic_long_inc(&pif->mmio_ops);	// The ISR read
 	
 
 	if ( (icr & ICR_INT_RXRDY) && (icr & ICR_MSK_RXRDY) ) {
         
-		paddr = (phys_addr_t)ZAP_REG_READ(iDevice, ZAP_REG_RBAR);
+		paddr = (phys_addr_t)zap_reg_read(pif, ZAP_REG_RBAR);
 		offset = (unsigned long)paddr;
 
 		pdma_if->interface[iDevice].rx_dma_count++;
@@ -316,7 +408,9 @@ dma_isr(
 		offset -= pool_packets_offset(&pdma_if->zap_dev->interface[iDevice].rx_pool);
 		pbuf = pool_offset2pbuf(&pdma_if->zap_dev->interface[iDevice].rx_pool, offset);
 
-		len = ZAP_REG_READ(iDevice, ZAP_REG_BSR);
+		len = zap_reg_read(pif, ZAP_REG_BSR);
+		// The relaxed reads above must complete before the packet is read.
+		rmb();
 
 		flags = 0;
 		if (pdma_if->zap_dev->interface[iDevice].rx_jumbo_pkt_enable == 0){
@@ -339,7 +433,10 @@ dma_isr(
 			len = len << 2;//Time 4
 		}
 
-		err = pool_enqbuf(&pdma_if->zap_dev->interface[iDevice].rx_pool, pbuf, (unsigned long)len, (unsigned long)ooblen, flags);
+		if (zap_fwd_rx(dev, iDevice, pbuf, (unsigned long)len, (unsigned long)ooblen, flags))
+			err = 0;
+		else
+			err = pool_enqbuf(&pdma_if->zap_dev->interface[iDevice].rx_pool, pbuf, (unsigned long)len, (unsigned long)ooblen, flags);
 		if (err) {
 			printk(KERN_ERR MODNAME "**ERROR RUNNING pool_enqbuf\n");
 			pool_dump(&pdma_if->zap_dev->interface[iDevice].rx_pool, 0);
@@ -349,13 +446,17 @@ dma_isr(
 
 		// TX
 	if ( (icr & ICR_INT_TX_FULL_RDY) && (icr & ICR_MSK_TX_FULL_RDY) ){
-		if (list_empty(&pdma_if->zap_dev->interface[iDevice].tx_pool.fifolist)){
-			ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_CLR_TX_FULL_RDY);
+		if (list_empty(&pdma_if->zap_dev->interface[iDevice].tx_pool.fifolist) && 
+				!zap_fwd_tx_pending(dev, iDevice)){
+			zap_reg_post(pif, ZAP_REG_ICR, ICR_CLR_TX_FULL_RDY);
 		} else {
 
 			pdma_if->interface[iDevice].tx_dma_count++;
 
-			iRetVal = pool_deqbuf_try(	&pdma_if->zap_dev->interface[iDevice].tx_pool, 
+			// Forwarded RX buffers go first, then the TX pool
+			iRetVal = zap_fwd_tx_get(dev, iDevice, &pbuf, &ulLen, &ulOoblen);
+			if (!iRetVal)
+				iRetVal = pool_deqbuf_try(	&pdma_if->zap_dev->interface[iDevice].tx_pool, 
                     &pbuf, &ulLen, &ulOoblen, &flags );
 			if (!iRetVal) {
 				printk(KERN_ERR MODNAME "ERROR: ICR_INT_TX_FULL_RDY Active, could not deqbuf\n"); //THIS HAPPENS
@@ -369,23 +470,27 @@ dma_isr(
 				ulTemp = ulLen >> 2;
 			}
 
-			ZAP_REG_WRITE(iDevice, ZAP_REG_TBAR, (uint32_t)pbuf);
-			ZAP_REG_WRITE(iDevice, ZAP_REG_BSR, (uint32_t)ulTemp);
+			// The BSR write launches the DMA; TBAR only needs to land first.
+			zap_reg_post(pif, ZAP_REG_TBAR, (uint32_t)(uintptr_t)pbuf);
+			zap_reg_doorbell(pif, ZAP_REG_BSR, (uint32_t)ulTemp);
 
-			if (list_empty(&pdma_if->zap_dev->interface[iDevice].tx_pool.fifolist)){
+			if (list_empty(&pdma_if->zap_dev->interface[iDevice].tx_pool.fifolist) && 
+					!zap_fwd_tx_pending(dev, iDevice)){
 			//If we just wrote the last packet in the pool, unmask interrupt
-				ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_CLR_TX_FULL_RDY);
+				zap_reg_post(pif, ZAP_REG_ICR, ICR_CLR_TX_FULL_RDY);
 			}
 		}
 	}
 
 	if ( (icr & ICR_INT_TX_FREE_RDY) && (icr & ICR_MSK_TX_FREE_RDY)) {
 
-		ulTemp = (unsigned long)ZAP_REG_READ(iDevice, ZAP_REG_TBAR);
+		ulTemp = (unsigned long)zap_reg_read(pif, ZAP_REG_TBAR);
 
 		pbuf = (void *)ulTemp;
 
 		iRetVal = pool_freebuf(&pdma_if->zap_dev->interface[iDevice].tx_pool, pbuf);
+		if (iRetVal < 0)
+			iRetVal = zap_fwd_tx_done(dev, iDevice, pbuf);
 		if (iRetVal < 0) {
 			printk(KERN_ERR MODNAME "ERROR: Pool_freebuf returned %d\n",iRetVal);
 		}
@@ -404,30 +509,27 @@ dma_isr(
 
 int
 dma_ll_start_tx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
 
-	pdma_if->interface[iDevice].tx_dma_count = 0;
+	struct dma_if_interface * pif = &pdma_if->interface[iDevice];
+	uint32_t mode = 0;
 
-	ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_TXEN);
-
-	udelay(1);
-	ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, CSR_TXEN, CSR_TXEN);
+	pif->tx_dma_count = 0;
 
 	if (pdma_if->zap_dev->interface[iDevice].tx_header_enable)
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, CSR_TX_OOB, CSR_TX_OOB);
-	else
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_TX_OOB);	
-
+		mode |= CSR_TX_OOB;
 	if (pdma_if->zap_dev->interface[iDevice].tx_jumbo_pkt_enable)
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, CSR_TX_JUMBO_EN, CSR_TX_JUMBO_EN);
-	else
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_TX_JUMBO_EN);
+		mode |= CSR_TX_JUMBO_EN;
+
+	zap_csr_restart(pif, CSR_TXEN, CSR_TX_OOB | CSR_TX_JUMBO_EN, mode);
 
 	//Implement masked in future?
 	//ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_SET_TXERR | ICR_SET_TX_FREE_RDY | ICR_SET_GLBL);
-    ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_SET_TX_FREE_RDY | ICR_SET_GLBL);
+    zap_reg_doorbell(pif, ZAP_REG_ICR, ICR_SET_TX_FREE_RDY | ICR_SET_GLBL);
 	//ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_SET_TXERR | ICR_SET_GLBL);
 
 	pdma_if->interface[iDevice].tx_on = 1;
@@ -437,15 +539,20 @@ dma_ll_start_tx(
 
 int
 dma_ll_start_rx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
 	unsigned long ulPayloadWords;
 	unsigned long ulOobWords;
 	unsigned long ulTemp;
 	int err = 0;
+	int cpu;
+	struct dma_if_interface * pif = &pdma_if->interface[iDevice];
+	uint32_t mode = 0;
 
-	pdma_if->interface[iDevice].rx_dma_count = 0;
+	pif->rx_dma_count = 0;
 
 	//
 	// Reset Zap and enable interrupts
@@ -467,40 +574,41 @@ dma_ll_start_rx(
 		ulTemp = (ulPayloadWords - 1);
 	}
 
-	ZAP_REG_WRITE(iDevice, ZAP_REG_MAX_RX_SIZE, (uint32_t)ulTemp);
-
-	ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_RXEN);
-	udelay(1);
-	ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, CSR_RXEN, CSR_RXEN);
+	zap_reg_post(pif, ZAP_REG_MAX_RX_SIZE, (uint32_t)ulTemp);
 
 	if (pdma_if->zap_dev->interface[iDevice].rx_header_enable)
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, CSR_RX_OOB, CSR_RX_OOB);
-	else
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_RX_OOB);	
-
+		mode |= CSR_RX_OOB;
 	if (pdma_if->zap_dev->interface[iDevice].rx_jumbo_pkt_enable)
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, CSR_RX_JUMBO_EN, CSR_RX_JUMBO_EN);
-	else
-		ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_RX_JUMBO_EN);
+		mode |= CSR_RX_JUMBO_EN;
+
+	zap_csr_restart(pif, CSR_RXEN, CSR_RX_OOB | CSR_RX_JUMBO_EN, mode);
 
-	ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_SET_RXRDY | ICR_SET_GLBL);
+	zap_reg_doorbell(pif, ZAP_REG_ICR, ICR_SET_RXRDY | ICR_SET_GLBL);
+
+	cpu = pdma_if->interface[iDevice].cpu;
+	if (cpu != WORK_CPU_UNBOUND && !cpu_online(cpu))
+		cpu = WORK_CPU_UNBOUND;
 
 	pdma_if->interface[iDevice].rx_on = 1;
-	queue_work( pdma_if->interface[iDevice].prx_workqueue, &pdma_if->interface[iDevice].rx_work );
+	queue_work_on( cpu, pdma_if->interface[iDevice].prx_workqueue, &pdma_if->interface[iDevice].rx_work );
 
 	return err;
 }
 
 int
 dma_ll_stop_tx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
 	int err;
 	pdma_if->interface[iDevice].tx_on = 0;
 
-	ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_TXEN);
-	ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_CLR_TX_FREE_RDY);
+	zap_csr_clear(&pdma_if->interface[iDevice], CSR_TXEN);
+	zap_reg_doorbell(&pdma_if->interface[iDevice], ZAP_REG_ICR, ICR_CLR_TX_FREE_RDY);
+
+	zap_fwd_tx_drain(dev, iDevice);
 
 	//Need to somehow refill pool?
 
@@ -519,20 +627,22 @@ dma_ll_stop_tx(
 
 int
 dma_ll_stop_rx(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
 	int err;
 
     //Disable Interrupts (was occasionaly seeing error when this doesn’t happen)
-	ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_CLR_RXRDY);
+	zap_reg_doorbell(&pdma_if->interface[iDevice], ZAP_REG_ICR, ICR_CLR_RXRDY);
 
 	pdma_if->interface[iDevice].rx_on = 0;
 
 	//
 	// Disable zap.
 	//
-	ZAP_REG_WRITE_MASKED(iDevice, ZAP_REG_CSR, 0, CSR_RXEN);
+	zap_csr_clear(&pdma_if->interface[iDevice], CSR_RXEN);
 
 	flush_workqueue( pdma_if->interface[iDevice].prx_workqueue );
 
@@ -561,6 +671,7 @@ dma_ll_init(
 	unsigned long zap_pool_paddr;
 	unsigned long zap_pool_size;
 	unsigned long pow2_boundary_pages = 1;
+	struct dma_if * pdma_if;
 
 	int err;
     int i;
@@ -588,6 +699,11 @@ dma_ll_init(
 	    return -ENOMEM;
     }
 
+	pdma_if = kzalloc( sizeof(struct dma_if), GFP_KERNEL );
+	if ( !pdma_if )
+		return -ENOMEM;
+	dev->dma_if = pdma_if;
+
 	pdma_if->rx_buffer_paddr = rx_pool_paddr;
 	pdma_if->rx_buffer_size = rx_pool_size;
 
@@ -597,135 +713,297 @@ dma_ll_init(
 	pdma_if->zap_dev = dev;
 
 	pdma_if->irq = -1;
+	pdma_if->fpga_params_valid = 0;
+	spin_lock_init(&pdma_if->reg_lock);
 
-	pdma_if->zap_reg = ioremap(zap_devp->reg_base, zap_devp->reg_sz);
-	if (pdma_if->zap_reg == NULL) 
-        return -ENOMEM;
+	pdma_if->zap_reg = ioremap(dev->reg_base, dev->reg_sz);
+	if (pdma_if->zap_reg == NULL) {
+		err = -ENOMEM;
+		goto fail;
+	}
 
-    pdma_if->interface = kzalloc( zap_devp->num_devices * sizeof(dma_if), GFP_KERNEL );
-    if ( !pdma_if->interface )
-        return -ENOMEM;
+    pdma_if->interface = kzalloc( dev->num_devices * sizeof(struct dma_if_interface), GFP_KERNEL );
+    if ( !pdma_if->interface ) {
+		err = -ENOMEM;
+		goto fail;
+	}
 
-    for (i = 0; i < zap_devp->num_devices; i++) {
+    for (i = 0; i < dev->num_devices; i++) {
+	    pdma_if->interface[i].owner = pdma_if;
 	    pdma_if->interface[i].rx_on = 0;
 	    pdma_if->interface[i].tx_on = 0;
         pdma_if->interface[i].iDevice = i;
-	    pdma_if->interface[i].prx_workqueue = create_singlethread_workqueue( "dma_rx_wq" );
+	    pdma_if->interface[i].cpu = WORK_CPU_UNBOUND;
+	    pdma_if->interface[i].regs = pdma_if->zap_reg + i * ZAP_IF_REG_STRIDE;
+	    //
+	    // Per-cpu (bound) workqueue, so that queue_work_on() actually runs the
+	    // refill worker on the interface's chosen CPU.
+	    //
+	    pdma_if->interface[i].prx_workqueue = alloc_workqueue( "zap%d_rx_wq%d", 0, 1, dev->instance, i );
+	    if ( !pdma_if->interface[i].prx_workqueue ) {
+		    err = -ENOMEM;
+		    goto fail;
+	    }
 	    INIT_WORK( &pdma_if->interface[i].rx_work, dma_rx_task );
     }
 
 	/* The IRQ resource */
-	pdma_if->irq = xlate_irq(zap_devp->hw_irq);
+	pdma_if->irq = xlate_irq(dev->hw_irq);
 	if (pdma_if->irq <= 0) {
 		pr_err("get_resource for IRQ for ZAP dev failed\n");
-		return -ENODEV;
-	
+		pdma_if->irq = -1;
+		err = -ENODEV;
+		goto fail;
 	}
-    err = request_irq(pdma_if->irq, dma_isr, 0, "zap_dma", NULL);
+    err = request_irq(pdma_if->irq, dma_isr, 0, dev_name(dev->dev), dev);
 	if (err) {
 		pr_err("unable to request ZAP IRQ\n");
-		return err;
+		pdma_if->irq = -1;
+		goto fail;
 	}
 
+	// Nothing is open yet, so the parameters can be read and cached now.
+	dma_ll_update_fpga_parameters(dev, 0);
+
 	return 0;
+
+  fail:
+	dma_ll_cleanup(dev);
+	return err;
 }
 
 int 
 dma_ll_cleanup(
-	void
+	struct zap_dev * dev
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
     int i;
 
-    for ( i = 0; i < zap_devp->num_devices; i++) {
-	    destroy_workqueue( pdma_if->interface[i].prx_workqueue );
-    }
-
-	if (pdma_if->zap_reg) {
-		iounmap(pdma_if->zap_reg);
-	}
+	if ( !pdma_if )
+		return 0;
 
 	if (pdma_if->irq >= 0){
-		free_irq(pdma_if->irq, NULL);
+		irq_set_affinity_hint(pdma_if->irq, NULL);
+		free_irq(pdma_if->irq, dev);
 		pdma_if->irq = -1;
 	}
 
     if ( pdma_if->interface ) {
+	    for ( i = 0; i < dev->num_devices; i++) {
+		    if ( pdma_if->interface[i].prx_workqueue )
+			    destroy_workqueue( pdma_if->interface[i].prx_workqueue );
+	    }
 		kfree( pdma_if->interface );
 	}
 
+	if (pdma_if->zap_reg) {
+		iounmap(pdma_if->zap_reg);
+	}
+
+	kfree( pdma_if );
+	dev->dma_if = NULL;
+
 	return 0;
 }
 
 int 
 dma_ll_rx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
 	return pdma_if->interface[iDevice].rx_on;
 }
 
 int 
 dma_ll_tx_is_on(
+	struct zap_dev * dev,
 	int iDevice
 	)
 {
+	struct dma_if * pdma_if = dev->dma_if;
 	return pdma_if->interface[iDevice].tx_on;
 }
 
 void
 dma_ll_tx_write_buf(
+	struct zap_dev * dev,
     int iDevice)
 {
-	ZAP_REG_WRITE(iDevice, ZAP_REG_ICR, ICR_SET_TX_FULL_RDY);
+	struct dma_if * pdma_if = dev->dma_if;
+
+	zap_reg_doorbell(&pdma_if->interface[iDevice], ZAP_REG_ICR, ICR_SET_TX_FULL_RDY);
 }
 
 void
-dma_ll_update_high_water_marks(int iDevice){
+dma_ll_update_high_water_marks(struct zap_dev * dev, int iDevice){
+	struct dma_if * pdma_if = dev->dma_if;
 	unsigned long ulTemp;
 
-	ulTemp = (unsigned long)ZAP_REG_READ(iDevice, ZAP_REG_HIGH_WATER_MARK);
+	ulTemp = (unsigned long)zap_reg_read(&pdma_if->interface[iDevice], ZAP_REG_HIGH_WATER_MARK);
 	pdma_if->zap_dev->interface[iDevice].rx_highwater = 4 * ((ulTemp >> HIGH_WATER_RX_SHIFT) & 0x0000ffff);
 	pdma_if->zap_dev->interface[iDevice].tx_highwater = 4 * ((ulTemp >> HIGH_WATER_TX_SHIFT) & 0x0000ffff);
 }
 
-int dma_ll_rx_dma_count(int iDevice){ return pdma_if->interface[iDevice].rx_dma_count; }
-int dma_ll_tx_dma_count(int iDevice){ return pdma_if->interface[iDevice].tx_dma_count; }
+int dma_ll_rx_dma_count(struct zap_dev * dev, int iDevice){ return dev->dma_if->interface[iDevice].rx_dma_count; }
+int dma_ll_tx_dma_count(struct zap_dev * dev, int iDevice){ return dev->dma_if->interface[iDevice].tx_dma_count; }
 
-void
-dma_ll_update_fpga_parameters()
+unsigned long dma_ll_mmio_ops(struct zap_dev * dev, int iDevice){ return atomic_long_read(&dev->dma_if->interface[iDevice].mmio_ops); }
+void dma_ll_reset_mmio_ops(struct zap_dev * dev, int iDevice){ atomic_long_set(&dev->dma_if->interface[iDevice].mmio_ops, 0); }
+
+//
+// Read the FPGA parameters into p.  READ_VERSION changes what some of the
+// registers return (so the map looks like that of the old Zynq ZAP
+// interface), so no DMA may be running while this is called.
+//
+static void
+dma_ll_read_fpga_parameters(
+	struct dma_if * pdma_if,
+	struct zap_fpga_parameters * p
+	)
 {
 	uint32_t ulTemp;
 
+    zap_core_write(pdma_if, ZAP_REG_READ_VERSION,0x00000001);
+
+    ulTemp = zap_core_read(pdma_if, ZAP_IF_REG_STRIDE + FPGA_VERSION_REG);
+
+    p->fpga_board_code = (ulTemp >> FPGA_VERSION_BOARD_SHIFT) & 0x000000ff;
+    p->fpga_version_major = (ulTemp >> FPGA_VERSION_MAJOR_SHIFT) & 0x000000ff;
+    p->fpga_version_minor = (ulTemp >> FPGA_VERSION_MINOR_SHIFT) & 0x000000ff;
+    p->fpga_version_release = (ulTemp >> FPGA_VERSION_RELEASE_SHIFT) & 0x000000ff;
+
+    //Update FIFO Size Registers
+    ulTemp = zap_core_read(pdma_if, ZAP_REG_RX_FIFO_SIZE);
+    p->rx_dat_fifo_size = 4 * (ulTemp & 0x0000ffff);
+    p->rx_oob_fifo_size = 4 * ((ulTemp >> 16) & 0x0000ffff);
+
+    ulTemp = zap_core_read(pdma_if, ZAP_REG_TX_FIFO_SIZE);
+    p->tx_dat_fifo_size = 4 * (ulTemp & 0x0000ffff);
+    p->tx_oob_fifo_size = 4 * ((ulTemp >> 16) & 0x0000ffff);
+
+    ulTemp = zap_core_read(pdma_if, ZAP_REG_NUM_PORTS);
+    p->num_interfaces = (int) ulTemp;
+
+    if (p->num_interfaces == 0) //Incase an older FPGA version is present
+        p->num_interfaces = 1;
+
+    zap_core_write(pdma_if, ZAP_REG_READ_VERSION,0x00000000);
+}
+
+//
+// The parameters are fixed for a given bitstream, so they are read once and
+// cached.  Pass force to read them again (e.g. after a reconfiguration).
+//
+void
+dma_ll_update_fpga_parameters(
+	struct zap_dev * dev,
+	int force
+	)
+{
+	struct dma_if * pdma_if = dev->dma_if;
+
+	if (pdma_if->fpga_params_valid && !force)
+		return;
+
     //Cannot do this while a device is open, because I need to alter the return value of some registers
-    //This was done so that the register map looks like that of the old Zynq ZAP interface
     if (pdma_if->zap_dev->open_count == 0) {
+        dma_ll_read_fpga_parameters(pdma_if, &pdma_if->zap_dev->fpga_params);
+        pdma_if->fpga_params_valid = 1;
+    }
+}
+
+//
+// Read the parameters of a newly loaded bitstream while devices are open.
+// The caller must have stopped DMA on every interface; the IRQ is held off
+// for the few register reads so the ISR can't see the READ_VERSION view.
+//
+void
+dma_ll_reread_fpga_parameters(
+	struct zap_dev * dev,
+	struct zap_fpga_parameters * p
+	)
+{
+	struct dma_if * pdma_if = dev->dma_if;
+
+	disable_irq(pdma_if->irq);
+	dma_ll_read_fpga_parameters(pdma_if, p);
+	enable_irq(pdma_if->irq);
+}
+
+//
+// Pin the RX refill worker of an interface to the first online CPU in
+// cpu_mask, and steer the (shared) ZAP IRQ to the union of all interfaces'
+// chosen CPUs.  A cpu_mask of zero removes the interface's affinity.
+//
+// The IRQ affinity takes effect immediately; the refill worker moves the next
+// time RX DMA is started.  Serialized with the other DMA control paths by
+// dma_sem.
+//
+int
+dma_ll_set_cpu_affinity(
+	struct zap_dev * dev,
+	int iDevice,
+	unsigned long cpu_mask
+	)
+{
+	struct dma_if * pdma_if = dev->dma_if;
+	struct cpumask mask;
+	struct cpumask irq_mask;
+	int cpu;
+	int i;
+
+	cpumask_clear(&mask);
+	for_each_set_bit(cpu, &cpu_mask, BITS_PER_LONG) {
+		if (cpu < nr_cpu_ids)
+			cpumask_set_cpu(cpu, &mask);
+	}
+	cpumask_and(&mask, &mask, cpu_online_mask);
 
-        ZAP_REG_WRITE(0,ZAP_REG_READ_VERSION,0x00000001);
+	if (cpu_mask && cpumask_empty(&mask))
+		return -EINVAL;
 
-        ulTemp = ZAP_REG_READ(1,FPGA_VERSION_REG);
+	if (down_interruptible(&dev->dma_sem))
+		return -ERESTARTSYS;
 
-        pdma_if->zap_dev->fpga_params.fpga_board_code = (ulTemp >> FPGA_VERSION_BOARD_SHIFT) & 0x000000ff;
-        pdma_if->zap_dev->fpga_params.fpga_version_major = (ulTemp >> FPGA_VERSION_MAJOR_SHIFT) & 0x000000ff;
-        pdma_if->zap_dev->fpga_params.fpga_version_minor = (ulTemp >> FPGA_VERSION_MINOR_SHIFT) & 0x000000ff;
-        pdma_if->zap_dev->fpga_params.fpga_version_release = (ulTemp >> FPGA_VERSION_RELEASE_SHIFT) & 0x000000ff;
+	pdma_if->interface[iDevice].cpu = cpu_mask ? cpumask_first(&mask) : WORK_CPU_UNBOUND;
+	pdma_if->zap_dev->interface[iDevice].cpu_affinity = cpu_mask;
 
-        //Update FIFO Size Registers
-        ulTemp = ZAP_REG_READ(0, ZAP_REG_RX_FIFO_SIZE);
-        pdma_if->zap_dev->fpga_params.rx_dat_fifo_size = 4 * (ulTemp & 0x0000ffff);
-        pdma_if->zap_dev->fpga_params.rx_oob_fifo_size = 4 * ((ulTemp >> 16) & 0x0000ffff);
+	cpumask_clear(&irq_mask);
+	for (i = 0; i < pdma_if->zap_dev->num_devices; i++) {
+		if (pdma_if->interface[i].cpu != WORK_CPU_UNBOUND)
+			cpumask_set_cpu(pdma_if->interface[i].cpu, &irq_mask);
+	}
+	if (cpumask_empty(&irq_mask))
+		cpumask_copy(&irq_mask, cpu_online_mask);
 
-        ulTemp = ZAP_REG_READ(0, ZAP_REG_TX_FIFO_SIZE);
-        pdma_if->zap_dev->fpga_params.tx_dat_fifo_size = 4 * (ulTemp & 0x0000ffff);
-        pdma_if->zap_dev->fpga_params.tx_oob_fifo_size = 4 * ((ulTemp >> 16) & 0x0000ffff);
+	// irq_affinity is registered as the hint: withdraw it while it changes,
+	// so /proc never reads it half written
+	if (pdma_if->irq >= 0)
+		irq_set_affinity_hint(pdma_if->irq, NULL);
+	cpumask_copy(&pdma_if->irq_affinity, &irq_mask);
+	if (pdma_if->irq >= 0)
+		irq_set_affinity_hint(pdma_if->irq, &pdma_if->irq_affinity);
 
-        ulTemp = ZAP_REG_READ(0,ZAP_REG_NUM_PORTS);
-        pdma_if->zap_dev->fpga_params.num_interfaces = (int) ulTemp;
+	up(&dev->dma_sem);
 
-        if (pdma_if->zap_dev->fpga_params.num_interfaces == 0) //Incase an older FPGA version is present
-            pdma_if->zap_dev->fpga_params.num_interfaces = 1;
+	dev_info(pdma_if->zap_dev->dev, "interface %d: cpu mask 0x%lx, placed on cpu %d, irq cpus %*pbl\n",
+			iDevice, cpu_mask, dma_ll_cpu_placement(dev, iDevice),
+			cpumask_pr_args(&irq_mask));
 
-        ZAP_REG_WRITE(0,ZAP_REG_READ_VERSION,0x00000000);
-    }
+	return 0;
+}
 
+int
+dma_ll_cpu_placement(
+	struct zap_dev * dev,
+	int iDevice
+	)
+{
+	struct dma_if * pdma_if = dev->dma_if;
+	if (pdma_if->interface[iDevice].cpu == WORK_CPU_UNBOUND)
+		return -1;
+	return pdma_if->interface[iDevice].cpu;
 }
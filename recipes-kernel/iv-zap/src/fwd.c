@@ -0,0 +1,487 @@
+/*
+ * ZAP in-kernel forwarding
+ *
+ * (C) Copyright 2021, iVeia, LLC
+ *
+ * An RX interface can be set to forward its packets, instead of queueing them
+ * for read():
+ *
+ *	- To a TX interface of the same ZAP instance.  This is zero-copy: the RX
+ *	buffer is queued on the target's fwd_ring, and the DMA ISR hands it to
+ *	the TX FIFO as if it came from the TX pool, moving it to fwd_inflight.
+ *	When TX DMA is done with it, or the target's TX stops, it goes back to
+ *	the free list of the RX pool recorded in its descriptor.  Stopping
+ *	forwarding waits for all of them, before the RX pool can be flushed.
+ *
+ *	- To a connected UDP socket.  A worker, on the interface's CPU if it has
+ *	one, sends each packet (OOB header, if any, followed by the payload) with
+ *	kernel_sendmsg().  This costs a single copy, into the skb.  The pool is
+ *	mapped write-combined, so that copy never sees stale cache lines.
+ *
+ * Packets that can't be forwarded (target stopped, too big, ring full, send
+ * failed) are dropped and counted.
+ */
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/io.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/cpumask.h>
+#include <linux/uio.h>
+
+#include "_zap.h"
+#include "pool.h"
+#include "dma.h"
+#include "fwd.h"
+
+// How long stopping forwarding waits for the target's TX to return buffers
+#define ZAP_FWD_STOP_TIMEOUT_MS	1000
+
+///////////////////////////////////////////////////////////////////////////
+//
+// Private funcs
+//
+///////////////////////////////////////////////////////////////////////////
+
+//
+// Give a forwarded buffer back to the RX pool it came from.
+//
+static int
+zap_fwd_return(
+	struct zap_dev * dev,
+	const struct zap_fwd_desc * pdesc
+	)
+{
+	struct zap_if * psrc = &dev->interface[pdesc->src];
+	int err;
+
+	err = pool_freebuf( &psrc->rx_pool, pdesc->pbuf );
+	atomic_dec( &psrc->fwd_outstanding );
+	wake_up( &psrc->rx_pool.freeq );
+
+	return err;
+}
+
+//
+// Return the buffers queued (not yet handed to TX DMA) on a target's
+// fwd_ring that came from src, or all of them if src is negative.
+//
+static void
+zap_fwd_purge(
+	struct zap_dev * dev,
+	int iTarget,
+	int src
+	)
+{
+	struct zap_if * ptarget = &dev->interface[iTarget];
+	struct zap_fwd_desc desc;
+	unsigned long irqflags;
+	unsigned int n;
+
+	spin_lock_irqsave( &ptarget->fwd_tx_lock, irqflags );
+	for ( n = kfifo_len( &ptarget->fwd_ring ); n > 0; n-- ) {
+		if ( ! kfifo_get( &ptarget->fwd_ring, &desc ))
+			break;
+		if ( src < 0 || desc.src == src )
+			zap_fwd_return( dev, &desc );
+		else
+			kfifo_put( &ptarget->fwd_ring, desc );
+	}
+	spin_unlock_irqrestore( &ptarget->fwd_tx_lock, irqflags );
+}
+
+static void
+zap_fwd_sock_task(
+	struct work_struct * work
+	)
+{
+	struct zap_if * pif = container_of(work, struct zap_if, fwd_work);
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+	struct kvec vec;
+	void * pbuf;
+	unsigned long len, ooblen, flags;
+	phys_addr_t paddr;
+	int err;
+
+	while ( pool_deqbuf_try( &pif->rx_pool, &pbuf, &len, &ooblen, &flags )) {
+		paddr = (phys_addr_t)(uintptr_t)pbuf;
+
+		if ( flags ) {
+			atomic_long_inc( &pif->fwd_drops );
+		} else {
+			vec.iov_base = pif->fwd_vaddr + (paddr - pif->rx_paddr);
+			vec.iov_len = ooblen + len;
+			err = kernel_sendmsg( pif->fwd_sock, &msg, &vec, 1, vec.iov_len );
+			if ( err < 0 )
+				atomic_long_inc( &pif->fwd_drops );
+			else
+				atomic_long_inc( &pif->fwd_count );
+		}
+
+		pool_freebuf( &pif->rx_pool, pbuf );
+	}
+}
+
+//
+// Set the forwarding mode of an RX interface.  Once this returns, the ISR
+// will not start forwarding anything else under the old mode.
+//
+static void
+zap_fwd_set_mode(
+	struct zap_if * pif,
+	int mode,
+	int target
+	)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave( &pif->fwd_lock, irqflags );
+	pif->fwd_mode = mode;
+	pif->fwd_target = target;
+	spin_unlock_irqrestore( &pif->fwd_lock, irqflags );
+}
+
+static int
+zap_fwd_get_mode(
+	struct zap_if * pif,
+	int * ptarget
+	)
+{
+	unsigned long irqflags;
+	int mode;
+
+	spin_lock_irqsave( &pif->fwd_lock, irqflags );
+	mode = pif->fwd_mode;
+	if ( ptarget )
+		*ptarget = pif->fwd_target;
+	spin_unlock_irqrestore( &pif->fwd_lock, irqflags );
+
+	return mode;
+}
+
+static bool
+zap_fwd_fits(
+	struct zap_if * ptarget,
+	unsigned long len,
+	unsigned long ooblen
+	)
+{
+	if ( ptarget->tx_jumbo_pkt_enable )
+		return true;
+	if ( len > ptarget->tx_payload_max_size )
+		return false;
+	if ( ooblen && ( ! ptarget->tx_header_enable || ooblen > ptarget->tx_header_size ))
+		return false;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+// Public funcs
+//
+///////////////////////////////////////////////////////////////////////////
+
+void
+zap_fwd_init(
+	struct zap_dev * dev,
+	int iDevice
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+
+	pif->fwd_dev = dev;
+	pif->fwd_mode = ZAP_FWD_NONE;
+	pif->fwd_target = -1;
+	spin_lock_init( &pif->fwd_lock );
+	atomic_set( &pif->fwd_outstanding, 0 );
+	spin_lock_init( &pif->fwd_tx_lock );
+	INIT_KFIFO( pif->fwd_ring );
+	INIT_KFIFO( pif->fwd_inflight );
+	INIT_WORK( &pif->fwd_work, zap_fwd_sock_task );
+}
+
+int
+zap_fwd_set_zap(
+	struct zap_dev * dev,
+	int iDevice,
+	unsigned long target
+	)
+{
+	int err;
+
+	err = zap_fwd_stop(dev, iDevice);
+	if ( err )
+		return err;
+
+	if ( target == ZAP_FWD_OFF )
+		return 0;
+	if ( target >= dev->fpga_params.num_interfaces )
+		return -EINVAL;
+
+	atomic_long_set( &dev->interface[iDevice].fwd_count, 0 );
+	atomic_long_set( &dev->interface[iDevice].fwd_drops, 0 );
+	zap_fwd_set_mode( &dev->interface[iDevice], ZAP_FWD_ZAP, (int) target );
+
+	return 0;
+}
+
+int
+zap_fwd_set_socket(
+	struct zap_dev * dev,
+	int iDevice,
+	int fd
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+	struct socket * sock;
+	int err;
+
+	err = zap_fwd_stop(dev, iDevice);
+	if ( err )
+		return err;
+
+	if ( fd < 0 )
+		return 0;
+
+	sock = sockfd_lookup( fd, &err );
+	if ( !sock )
+		return err;
+	if ( sock->type != SOCK_DGRAM ) {
+		sockfd_put( sock );
+		return -EPROTOTYPE;
+	}
+
+	pif->fwd_vaddr = memremap( pif->rx_paddr, pif->rx_size, MEMREMAP_WC );
+	if ( !pif->fwd_vaddr ) {
+		sockfd_put( sock );
+		return -ENOMEM;
+	}
+
+	pif->fwd_sock = sock;
+	atomic_long_set( &pif->fwd_count, 0 );
+	atomic_long_set( &pif->fwd_drops, 0 );
+	zap_fwd_set_mode( pif, ZAP_FWD_SOCKET, -1 );
+
+	return 0;
+}
+
+bool
+zap_fwd_is_on(
+	struct zap_dev * dev,
+	int iDevice
+	)
+{
+	return zap_fwd_get_mode( &dev->interface[iDevice], NULL ) != ZAP_FWD_NONE;
+}
+
+//
+// Stop forwarding on an RX interface.  Zero-copy buffers still queued on the
+// target are returned now; those already on its TX DMA are waited for, so
+// that the RX pool can be flushed once this returns 0.  If the target's TX
+// doesn't give them back in time, forwarding is left up and -EBUSY returned:
+// the RX pool must not be touched then.
+//
+int
+zap_fwd_stop(
+	struct zap_dev * dev,
+	int iDevice
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+	int target;
+	int mode = zap_fwd_get_mode( pif, &target );
+
+	if ( mode == ZAP_FWD_NONE )
+		return 0;
+
+	zap_fwd_set_mode( pif, ZAP_FWD_NONE, -1 );
+	cancel_work_sync( &pif->fwd_work );
+
+	if ( mode == ZAP_FWD_ZAP ) {
+		zap_fwd_purge( dev, target, iDevice );
+		if ( ! wait_event_timeout( pif->rx_pool.freeq, atomic_read( &pif->fwd_outstanding ) == 0,
+				msecs_to_jiffies( ZAP_FWD_STOP_TIMEOUT_MS ))) {
+			dev_err( dev->dev, "interface %d: %d forwarded buffers not returned by TX %d, still forwarding\n",
+					iDevice, atomic_read( &pif->fwd_outstanding ), target );
+			zap_fwd_set_mode( pif, mode, target );
+			return -EBUSY;
+		}
+	}
+
+	if ( pif->fwd_sock ) {
+		sockfd_put( pif->fwd_sock );
+		pif->fwd_sock = NULL;
+	}
+	if ( pif->fwd_vaddr ) {
+		memunmap( pif->fwd_vaddr );
+		pif->fwd_vaddr = NULL;
+	}
+
+	return 0;
+}
+
+//
+// Offer a received buffer for forwarding.  Returns 0 if forwarding is off and
+// the caller should queue the buffer as usual, 1 if it was consumed
+// (forwarded or dropped).
+//
+int
+zap_fwd_rx(
+	struct zap_dev * dev,
+	int iDevice,
+	void * pbuf,
+	unsigned long len,
+	unsigned long ooblen,
+	unsigned long flags
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+	struct zap_if * ptarget;
+	struct zap_fwd_desc desc;
+	int consumed = 1;
+	bool queued = false;
+	int cpu;
+
+	spin_lock( &pif->fwd_lock );
+
+	switch ( pif->fwd_mode ) {
+		case ZAP_FWD_ZAP:
+			ptarget = &dev->interface[pif->fwd_target];
+			if ( ! flags && dma_tx_is_on(dev, pif->fwd_target) && zap_fwd_fits(ptarget, len, ooblen) ) {
+				desc.pbuf = pbuf;
+				desc.len = len;
+				desc.ooblen = ooblen;
+				desc.src = iDevice;
+				spin_lock( &ptarget->fwd_tx_lock );
+				queued = kfifo_put( &ptarget->fwd_ring, desc );
+				if ( queued )
+					atomic_inc( &pif->fwd_outstanding );
+				spin_unlock( &ptarget->fwd_tx_lock );
+			}
+			if ( queued ) {
+				atomic_long_inc( &pif->fwd_count );
+				dma_ll_tx_write_buf(dev, pif->fwd_target);
+			} else {
+				atomic_long_inc( &pif->fwd_drops );
+				pool_freebuf( &pif->rx_pool, pbuf );
+			}
+			break;
+
+		case ZAP_FWD_SOCKET:
+			if ( pool_enqbuf( &pif->rx_pool, pbuf, len, ooblen, flags ) == 0 ) {
+				cpu = dma_ll_cpu_placement( dev, iDevice );
+				if ( cpu < 0 || ! cpu_online( cpu ))
+					cpu = WORK_CPU_UNBOUND;
+				queue_work_on( cpu, system_wq, &pif->fwd_work );
+			} else {
+				atomic_long_inc( &pif->fwd_drops );
+				pool_freebuf( &pif->rx_pool, pbuf );
+			}
+			break;
+
+		default:
+			consumed = 0;
+			break;
+	}
+
+	spin_unlock( &pif->fwd_lock );
+
+	return consumed;
+}
+
+//
+// Get the next forwarded buffer for a TX interface, if any, as it is handed
+// to TX DMA.
+//
+int
+zap_fwd_tx_get(
+	struct zap_dev * dev,
+	int iDevice,
+	void ** ppbuf,
+	unsigned long * plen,
+	unsigned long * pooblen
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+	struct zap_fwd_desc desc;
+	unsigned long irqflags;
+	int got;
+
+	spin_lock_irqsave( &pif->fwd_tx_lock, irqflags );
+	got = ! kfifo_is_full( &pif->fwd_inflight ) && kfifo_get( &pif->fwd_ring, &desc );
+	if ( got )
+		kfifo_put( &pif->fwd_inflight, desc );
+	spin_unlock_irqrestore( &pif->fwd_tx_lock, irqflags );
+
+	if ( got ) {
+		*ppbuf = desc.pbuf;
+		*plen = desc.len;
+		*pooblen = desc.ooblen;
+	}
+
+	return got;
+}
+
+bool
+zap_fwd_tx_pending(
+	struct zap_dev * dev,
+	int iDevice
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+
+	return ! kfifo_is_empty( &pif->fwd_ring ) && ! kfifo_is_full( &pif->fwd_inflight );
+}
+
+//
+// TX DMA is done with a buffer that isn't from the TX pool: give it back to
+// the RX pool it was forwarded from.  TX completes in order, so it is the
+// oldest one in flight.
+//
+int
+zap_fwd_tx_done(
+	struct zap_dev * dev,
+	int iDevice,
+	void * pbuf
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+	struct zap_fwd_desc desc;
+	unsigned long irqflags;
+	int err = -EINVAL;
+
+	spin_lock_irqsave( &pif->fwd_tx_lock, irqflags );
+	if ( kfifo_peek( &pif->fwd_inflight, &desc ) && desc.pbuf == pbuf ) {
+		kfifo_skip( &pif->fwd_inflight );
+		err = zap_fwd_return( dev, &desc );
+	}
+	spin_unlock_irqrestore( &pif->fwd_tx_lock, irqflags );
+
+	return err;
+}
+
+//
+// TX is stopped, with TX_FREE off: return all forwarded buffers, whether TX
+// DMA had started on them or not.
+//
+void
+zap_fwd_tx_drain(
+	struct zap_dev * dev,
+	int iDevice
+	)
+{
+	struct zap_if * pif = &dev->interface[iDevice];
+	struct zap_fwd_desc desc;
+	unsigned long irqflags;
+
+	spin_lock_irqsave( &pif->fwd_tx_lock, irqflags );
+	while ( kfifo_get( &pif->fwd_inflight, &desc ))
+		zap_fwd_return( dev, &desc );
+	spin_unlock_irqrestore( &pif->fwd_tx_lock, irqflags );
+
+	zap_fwd_purge( dev, iDevice, -1 );
+}
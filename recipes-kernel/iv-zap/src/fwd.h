@@ -0,0 +1,88 @@
+/*
+ * ZAP in-kernel forwarding
+ *
+ * (C) Copyright 2021, iVeia, LLC
+ */
+#ifndef _FWD_H_
+#define _FWD_H_
+
+#include "_zap.h"
+
+#define ZAP_FWD_NONE	0
+#define ZAP_FWD_ZAP	1
+#define ZAP_FWD_SOCKET	2
+
+void
+zap_fwd_init(
+	struct zap_dev * dev,
+	int iDevice
+	);
+
+int
+zap_fwd_set_zap(
+	struct zap_dev * dev,
+	int iDevice,
+	unsigned long target
+	);
+
+int
+zap_fwd_set_socket(
+	struct zap_dev * dev,
+	int iDevice,
+	int fd
+	);
+
+int
+zap_fwd_stop(
+	struct zap_dev * dev,
+	int iDevice
+	);
+
+bool
+zap_fwd_is_on(
+	struct zap_dev * dev,
+	int iDevice
+	);
+
+/*
+ * Called from the DMA ISR
+ */
+int
+zap_fwd_rx(
+	struct zap_dev * dev,
+	int iDevice,
+	void * pbuf,
+	unsigned long len,
+	unsigned long ooblen,
+	unsigned long flags
+	);
+
+int
+zap_fwd_tx_get(
+	struct zap_dev * dev,
+	int iDevice,
+	void ** ppbuf,
+	unsigned long * plen,
+	unsigned long * pooblen
+	);
+
+bool
+zap_fwd_tx_pending(
+	struct zap_dev * dev,
+	int iDevice
+	);
+
+int
+zap_fwd_tx_done(
+	struct zap_dev * dev,
+	int iDevice,
+	void * pbuf
+	);
+
+void
+zap_fwd_tx_drain(
+	struct zap_dev * dev,
+	int iDevice
+	);
+
+#endif
@@ -108,6 +108,7 @@
 #include "_zap.h"
 #include "pool.h"
 #include "dma.h"
+#include "fwd.h"
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -128,7 +129,12 @@
 #define ZAP_POOL_MAX_RX_PACKETS ( DMA_BD_RX_NUM - 1 )
 #define ZAP_POOL_MAX_TX_PACKETS ( DMA_BD_TX_NUM - 1 )
 
-struct zap_dev * zap_devp = NULL;
+//
+// One class for all instances; each probed ZAP core gets its own instance
+// number (from a "zap" DT alias if present), chrdev region and cdev.
+//
+static struct class * zap_class;
+static DEFINE_IDA(zap_ida);
 
 ///////////////////////////////////////////////////////////////////////////
 //
@@ -152,52 +158,52 @@ zap_device_num(struct file *filp)
 }
 
 static void
-setup_multiple_pools(int iNumPools)
+setup_multiple_pools(struct zap_dev * dev, int iNumPools)
 {
     int i;
     unsigned long iRxSize,iTxSize;
     //unsigned int ulRxTopAddr;
 
-    iRxSize = zap_devp->rx_pool_size / iNumPools;
-    iTxSize = zap_devp->tx_pool_size / iNumPools;
+    iRxSize = dev->rx_pool_size / iNumPools;
+    iTxSize = dev->tx_pool_size / iNumPools;
 
     for (i = 0; i < iNumPools; i++) {
-        zap_devp->interface[i].rx_paddr = (phys_addr_t)PAGE_ALIGN(((uintptr_t)zap_devp->rx_pool_paddr + iRxSize * i));
-        zap_devp->interface[i].tx_paddr = (phys_addr_t)PAGE_ALIGN(((uintptr_t)zap_devp->tx_pool_paddr + iRxSize * i));
+        dev->interface[i].rx_paddr = (phys_addr_t)PAGE_ALIGN(((uintptr_t)dev->rx_pool_paddr + iRxSize * i));
+        dev->interface[i].tx_paddr = (phys_addr_t)PAGE_ALIGN(((uintptr_t)dev->tx_pool_paddr + iRxSize * i));
     }
 
     if (iNumPools == 1) {
-        zap_devp->interface[iNumPools-1].rx_size = zap_devp->rx_pool_size;
-        zap_devp->interface[iNumPools-1].tx_size = zap_devp->tx_pool_size;
+        dev->interface[iNumPools-1].rx_size = dev->rx_pool_size;
+        dev->interface[iNumPools-1].tx_size = dev->tx_pool_size;
     } else {
         //Fill in sizes
         for (i = 0; i < iNumPools-1; i++) {
-            zap_devp->interface[i].rx_size = zap_devp->interface[i+1].rx_paddr - zap_devp->interface[i].rx_paddr;
-            zap_devp->interface[i].tx_size = zap_devp->interface[i+1].tx_paddr - zap_devp->interface[i].tx_paddr;
+            dev->interface[i].rx_size = dev->interface[i+1].rx_paddr - dev->interface[i].rx_paddr;
+            dev->interface[i].tx_size = dev->interface[i+1].tx_paddr - dev->interface[i].tx_paddr;
         }
-        zap_devp->interface[iNumPools-1].rx_size = zap_devp->rx_pool_paddr + zap_devp->rx_pool_size - zap_devp->interface[iNumPools-1].rx_paddr;
-        zap_devp->interface[iNumPools-1].tx_size = zap_devp->tx_pool_paddr + zap_devp->tx_pool_size - zap_devp->interface[iNumPools-1].tx_paddr;
+        dev->interface[iNumPools-1].rx_size = dev->rx_pool_paddr + dev->rx_pool_size - dev->interface[iNumPools-1].rx_paddr;
+        dev->interface[iNumPools-1].tx_size = dev->tx_pool_paddr + dev->tx_pool_size - dev->interface[iNumPools-1].tx_paddr;
     }
 
 #if defined(DEBUG)
     //PRINT RX RESULTS
     printk(KERN_ERR "****SETUP_MULTIPLE_POOLS****\n");
-    printk(KERN_ERR "rx_paddr = 0x%llx\n",zap_devp->rx_pool_paddr);
-    printk(KERN_ERR "rx_size  = 0x%lx\n",zap_devp->rx_pool_size);
+    printk(KERN_ERR "rx_paddr = 0x%llx\n",dev->rx_pool_paddr);
+    printk(KERN_ERR "rx_size  = 0x%lx\n",dev->rx_pool_size);
     for (i=0;i<iNumPools;i++){
         printk(KERN_ERR "\t**POOL %d\n",i);
-        printk(KERN_ERR "\t\trx_paddr = 0x%llx\n",zap_devp->interface[i].rx_paddr);
-        printk(KERN_ERR "\t\trx_size  = 0x%lx\n",zap_devp->interface[i].rx_size);
+        printk(KERN_ERR "\t\trx_paddr = 0x%llx\n",dev->interface[i].rx_paddr);
+        printk(KERN_ERR "\t\trx_size  = 0x%lx\n",dev->interface[i].rx_size);
     }
 
     //PRINT TX RESULTS
     printk(KERN_ERR "****SETUP_MULTIPLE_POOLS****\n");
-    printk(KERN_ERR "tx_paddr = 0x%llx\n",zap_devp->tx_pool_paddr);
-    printk(KERN_ERR "tx_size  = 0x%lx\n",zap_devp->tx_pool_size);
+    printk(KERN_ERR "tx_paddr = 0x%llx\n",dev->tx_pool_paddr);
+    printk(KERN_ERR "tx_size  = 0x%lx\n",dev->tx_pool_size);
     for (i=0;i<iNumPools;i++){
         printk(KERN_ERR "\t**POOL %d\n",i);
-        printk(KERN_ERR "\t\ttx_paddr = 0x%llx\n",zap_devp->interface[i].tx_paddr);
-        printk(KERN_ERR "\t\ttx_size  = 0x%lx\n",zap_devp->interface[i].tx_size);
+        printk(KERN_ERR "\t\ttx_paddr = 0x%llx\n",dev->interface[i].tx_paddr);
+        printk(KERN_ERR "\t\ttx_size  = 0x%lx\n",dev->interface[i].tx_size);
     }
 #endif
 
@@ -205,14 +211,14 @@ setup_multiple_pools(int iNumPools)
 }
 
 static int 
-IsJumboPacketSupported(void)
+IsJumboPacketSupported(struct zap_dev * dev)
 {
 	#define VMAJOR_REQ       2
 	#define VMINOR_REQ       2
 	#define VRELEASE_REQ     'a'
-	#define VMAJOR       zap_devp->fpga_params.fpga_version_major
-	#define VMINOR       zap_devp->fpga_params.fpga_version_minor
-	#define VRELEASE     zap_devp->fpga_params.fpga_version_release
+	#define VMAJOR       dev->fpga_params.fpga_version_major
+	#define VMINOR       dev->fpga_params.fpga_version_minor
+	#define VRELEASE     dev->fpga_params.fpga_version_release
 
 	if (VMAJOR < VMAJOR_REQ)
 		return 0;
@@ -234,25 +240,26 @@ IsJumboPacketSupported(void)
 ///////////////////////////////////////////////////////////////////////////
 
 int zap_read_procmem(char *buf, char **start, off_t offset, int count, int *eof, void *data){
+	struct zap_dev * dev = data;
 	int len = 0;
 
     //re-read parameters incase a reconfiguration has occured
-    dma_ll_update_fpga_parameters();
-
-	len+= sprintf(buf + len, "FPGA CODE: %d\n",zap_devp->fpga_params.fpga_board_code);
-	len+= sprintf(buf + len, "FPGA Version: v%d_%d_%c\n",zap_devp->fpga_params.fpga_version_major, 
-            zap_devp->fpga_params.fpga_version_minor, zap_devp->fpga_params.fpga_version_release);
-    len+= sprintf(buf + len, "NUM_INTERFACES = %d\n",zap_devp->fpga_params.num_interfaces);
-	len+= sprintf(buf + len, "RX_DAT_FIFO_SIZE = %d\n",(unsigned int)zap_devp->fpga_params.rx_dat_fifo_size);
-	len+= sprintf(buf + len, "RX_OOB_FIFO_SIZE = %d\n",(unsigned int)zap_devp->fpga_params.rx_oob_fifo_size);
-	len+= sprintf(buf + len, "TX_DAT_FIFO_SIZE = %d\n",(unsigned int)zap_devp->fpga_params.tx_dat_fifo_size);
-	len+= sprintf(buf + len, "TX_OOB_FIFO_SIZE = %d\n",(unsigned int)zap_devp->fpga_params.tx_oob_fifo_size);
-	len+= sprintf(buf + len, "RX_MAX=%d\n",(unsigned int)zap_devp->interface[0].rx_payload_max_size);
-	len+= sprintf(buf + len, "RX_HDR=%d\n",(unsigned int)zap_devp->interface[0].rx_header_size);
-	len+= sprintf(buf + len, "TX_MAX=%d\n",(unsigned int)zap_devp->interface[0].tx_payload_max_size);
-	len+= sprintf(buf + len, "TX_HDR=%d\n",(unsigned int)zap_devp->interface[0].tx_header_size);
-	len+= sprintf(buf + len, "RX_DMA=%d\n",dma_ll_rx_dma_count(0));
-	len+= sprintf(buf + len, "TX_DMA=%d\n",dma_ll_tx_dma_count(0));
+    dma_ll_update_fpga_parameters(dev, 1);
+
+	len+= sprintf(buf + len, "FPGA CODE: %d\n",dev->fpga_params.fpga_board_code);
+	len+= sprintf(buf + len, "FPGA Version: v%d_%d_%c\n",dev->fpga_params.fpga_version_major, 
+            dev->fpga_params.fpga_version_minor, dev->fpga_params.fpga_version_release);
+    len+= sprintf(buf + len, "NUM_INTERFACES = %d\n",dev->fpga_params.num_interfaces);
+	len+= sprintf(buf + len, "RX_DAT_FIFO_SIZE = %d\n",(unsigned int)dev->fpga_params.rx_dat_fifo_size);
+	len+= sprintf(buf + len, "RX_OOB_FIFO_SIZE = %d\n",(unsigned int)dev->fpga_params.rx_oob_fifo_size);
+	len+= sprintf(buf + len, "TX_DAT_FIFO_SIZE = %d\n",(unsigned int)dev->fpga_params.tx_dat_fifo_size);
+	len+= sprintf(buf + len, "TX_OOB_FIFO_SIZE = %d\n",(unsigned int)dev->fpga_params.tx_oob_fifo_size);
+	len+= sprintf(buf + len, "RX_MAX=%d\n",(unsigned int)dev->interface[0].rx_payload_max_size);
+	len+= sprintf(buf + len, "RX_HDR=%d\n",(unsigned int)dev->interface[0].rx_header_size);
+	len+= sprintf(buf + len, "TX_MAX=%d\n",(unsigned int)dev->interface[0].tx_payload_max_size);
+	len+= sprintf(buf + len, "TX_HDR=%d\n",(unsigned int)dev->interface[0].tx_header_size);
+	len+= sprintf(buf + len, "RX_DMA=%d\n",dma_ll_rx_dma_count(dev, 0));
+	len+= sprintf(buf + len, "TX_DMA=%d\n",dma_ll_tx_dma_count(dev, 0));
 	return len;
 }
 
@@ -271,7 +278,7 @@ int zap_open(struct inode *inode, struct file *filp)
     dev_info(dev->dev, "%s() %s Device %d (%d)\n", __func__, is_tx ? "TX":"RX", iDevice,
 		    dev->fpga_params.num_interfaces);
 
-	dma_ll_update_fpga_parameters();
+	dma_ll_update_fpga_parameters(dev, 0);
 
 	if (iDevice >= dev->fpga_params.num_interfaces) {
 		return -ENXIO;
@@ -282,7 +289,7 @@ int zap_open(struct inode *inode, struct file *filp)
 
 	if ( (filp->f_flags & O_ACCMODE) != O_RDONLY ) {
 
-        setup_multiple_pools(zap_devp->fpga_params.num_interfaces);
+        setup_multiple_pools(dev, dev->fpga_params.num_interfaces);
 
         if (is_tx) {
 		if (down_trylock(&dev->interface[iDevice].in_use_tx)) {
@@ -293,8 +300,8 @@ int zap_open(struct inode *inode, struct file *filp)
 
 			dev->interface[iDevice].tx_payload_max_size = dev->fpga_params.tx_dat_fifo_size;
 
-	        err = pool_create(&zap_devp->interface[iDevice].tx_pool, (void *)zap_devp->interface[iDevice].tx_paddr, 
-                    zap_devp->interface[iDevice].tx_size);
+	        err = pool_create(&dev->interface[iDevice].tx_pool, (void *)dev->interface[iDevice].tx_paddr, 
+                    dev->interface[iDevice].tx_size);
 	        if (err) {
 		        printk(KERN_ERR "RX pool_create error %d\n", err);
 		        //goto fail;
@@ -318,8 +325,8 @@ int zap_open(struct inode *inode, struct file *filp)
 
 			dev->interface[iDevice].rx_payload_max_size = dev->fpga_params.rx_dat_fifo_size;
 
-	        err = pool_create(&zap_devp->interface[iDevice].rx_pool, (void *)zap_devp->interface[iDevice].rx_paddr, 
-                    zap_devp->interface[iDevice].rx_size);
+	        err = pool_create(&dev->interface[iDevice].rx_pool, (void *)dev->interface[iDevice].rx_paddr, 
+                    dev->interface[iDevice].rx_size);
 	        if (err) {
 		        printk(KERN_ERR "RX pool_create error %d\n", err);
 		        //goto fail;
@@ -361,12 +368,19 @@ int zap_release(struct inode *inode, struct file *filp)
 
 	//filp->private_data = dev;
 
-    if (dma_tx_is_on(iDevice)) {
-        dma_stop_tx(iDevice);
+    if (dma_tx_is_on(dev, iDevice)) {
+        dma_stop_tx(dev, iDevice);
 	}
 
-    if (dma_rx_is_on(iDevice)) {
-        dma_stop_rx(iDevice);
+    if (!is_tx && zap_fwd_stop(dev, iDevice)) {
+        // The target's TX still owns some of the RX pool: leave RX up and
+        // forwarding, and the interface held, rather than flush under it.
+        dev_err(dev->dev, "RX %d left forwarding and in use\n", iDevice);
+        return -EBUSY;
+	}
+
+    if (dma_rx_is_on(dev, iDevice)) {
+        dma_stop_rx(dev, iDevice);
 	}
 
 	if (down_interruptible(&dev->sem)) {
@@ -432,6 +446,10 @@ ssize_t zap_read(struct file *filp, char __user *buf, size_t count, loff_t *f_po
                 return retval;
 		}
 	} else {
+		// The packets are going to the forwarding target, not here
+		if ( zap_fwd_is_on(dev, iDevice) )
+			return -EBUSY;
+
 		if ( filp->f_flags & O_NONBLOCK ) {
 			if ( ! pool_deqbuf_try( &dev->interface[iDevice].rx_pool, &pbuf, &len, &ooblen, &flags )) 
                 return -EAGAIN;
@@ -508,9 +526,9 @@ ssize_t zap_write(struct file *filp, const char __user *buf, size_t count, loff_
 			err = pool_enqbuf( &dev->interface[iDevice].tx_pool, pbuf, len, ooblen, 0 );
 
 	#if defined(CONFIG_ARCH_ZYNQ) || defined(CONFIG_ARCH_ZYNQMP)
-			dma_ll_tx_write_buf(iDevice);
+			dma_ll_tx_write_buf(dev, iDevice);
 	#else
-			dma_ll_tx_write_buf(iDevice);
+			dma_ll_tx_write_buf(dev, iDevice);
     #endif
 		}
 		if ( err ) 
@@ -523,7 +541,7 @@ ssize_t zap_write(struct file *filp, const char __user *buf, size_t count, loff_
 	#if defined(CONFIG_ARCH_ZYNQ) || defined(CONFIG_ARCH_ZYNQMP)
 		//dma_ll_rx_free_buf();
 	#else
-		dma_ll_rx_free_buf(iDevice);
+		dma_ll_rx_free_buf(dev, iDevice);
     #endif
 	}
 
@@ -576,11 +594,11 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			__put_user( dev->status, (unsigned long __user *)arg);
 			break;
 		case ZAP_IOC_R_RX_HIGH_WATER_MARK:
-			dma_ll_update_high_water_marks(iDevice);
+			dma_ll_update_high_water_marks(dev, iDevice);
 			__put_user( dev->interface[iDevice].rx_highwater, (unsigned long __user *)arg);
 			break;
 		case ZAP_IOC_R_TX_HIGH_WATER_MARK:
-			dma_ll_update_high_water_marks(iDevice);
+			dma_ll_update_high_water_marks(dev, iDevice);
 			__put_user( dev->interface[iDevice].tx_highwater, (unsigned long __user *)arg);
 			break;
 		case ZAP_IOC_R_TX_MAX_SIZE:
@@ -588,7 +606,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			break;
 		case ZAP_IOC_W_TX_MAX_SIZE:
 			//retval = dma_stop();
-			retval = dma_stop_tx(iDevice);
+			retval = dma_stop_tx(dev, iDevice);
 			if ( retval ) 
                 break;
 			__get_user( ulTemp, (unsigned long __user *)arg);
@@ -623,7 +641,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			break;
 		case ZAP_IOC_W_TX_HEADER_SIZE:
 			//retval = dma_stop();
-			retval = dma_stop_tx(iDevice);
+			retval = dma_stop_tx(dev, iDevice);
 			if ( retval ) 
                 break;
 			__get_user( ulTemp, (unsigned long __user *)arg);
@@ -659,7 +677,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			break;
 		case ZAP_IOC_W_RX_MAX_SIZE:
 			//retval = dma_stop();
-			retval = dma_stop_rx(iDevice);
+			retval = dma_stop_rx(dev, iDevice);
 			if ( retval ) 
                 break;
 			__get_user( ulTemp, (unsigned long __user *)arg);
@@ -693,7 +711,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			break;
 		case ZAP_IOC_W_RX_HEADER_SIZE:
 			//retval = dma_stop();
-			retval = dma_stop_rx(iDevice);
+			retval = dma_stop_rx(dev, iDevice);
 			if ( retval ) 
                 break;
 			__get_user( ulTemp, (unsigned long __user *)arg);
@@ -730,7 +748,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		case ZAP_IOC_W_RX_JUMBO_EN:
 			//retval = dma_stop();
-			retval = dma_stop_rx(iDevice);
+			retval = dma_stop_rx(dev, iDevice);
 			if ( retval ) 
                 break;
 			__get_user( ulTemp, (unsigned long __user *)arg);
@@ -738,7 +756,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			if (ulTemp == 0)
 				dev->interface[iDevice].rx_jumbo_pkt_enable = 0;
 			else{
-				if (!IsJumboPacketSupported()) {
+				if (!IsJumboPacketSupported(dev)) {
 					retval = -EINVAL;
 					printk(KERN_ERR "ZAP : FPGA Image does not support Jumbo Packets\n");
 					break;
@@ -754,7 +772,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		case ZAP_IOC_W_TX_JUMBO_EN:
 			//retval = dma_stop();
-			retval = dma_stop_tx(iDevice);
+			retval = dma_stop_tx(dev, iDevice);
 			if ( retval ) 
                 break;
 			__get_user( ulTemp, (unsigned long __user *)arg);
@@ -762,7 +780,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			if (ulTemp == 0)
 				dev->interface[iDevice].tx_jumbo_pkt_enable = 0;
 			else{
-				if (!IsJumboPacketSupported()) {
+				if (!IsJumboPacketSupported(dev)) {
 					retval = -EINVAL;
 					printk(KERN_ERR "ZAP : FPGA Image does not support Jumbo Packets\n");
 					break;
@@ -782,7 +800,7 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			break;
 		case ZAP_IOC_R_RX_DMA_ON:
 			{
-				unsigned long dma_on = dma_rx_is_on(iDevice);
+				unsigned long dma_on = dma_rx_is_on(dev, iDevice);
 				__put_user( dma_on, (unsigned long __user *)arg);
 			}
 			break;
@@ -791,15 +809,15 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				unsigned long dma_on;
 				__get_user( dma_on, (unsigned long __user *)arg);
 				if ( dma_on ) {
-					retval = dma_start_rx(iDevice);
+					retval = dma_start_rx(dev, iDevice);
 				} else {
-					retval = dma_stop_rx(iDevice);
+					retval = dma_stop_rx(dev, iDevice);
 				}
 			}
 			break;
 		case ZAP_IOC_R_TX_DMA_ON:
 			{
-				unsigned long dma_on = dma_tx_is_on(iDevice);
+				unsigned long dma_on = dma_tx_is_on(dev, iDevice);
 				__put_user( dma_on, (unsigned long __user *)arg);
 			}
 			break;
@@ -808,9 +826,9 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				unsigned long dma_on;
 				__get_user( dma_on, (unsigned long __user *)arg);
 				if ( dma_on ) {
-					retval = dma_start_tx(iDevice);
+					retval = dma_start_tx(dev, iDevice);
 				}else{
-					retval = dma_stop_tx(iDevice);
+					retval = dma_stop_tx(dev, iDevice);
 				}
 			}
 			break;
@@ -826,6 +844,69 @@ long zap_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			__put_user(dev->open_count,(unsigned long __user *)arg);				
 			break;						
 
+		case ZAP_IOC_R_CPU_AFFINITY:
+			__put_user( dev->interface[iDevice].cpu_affinity, (unsigned long __user *)arg);
+			break;
+
+		case ZAP_IOC_W_CPU_AFFINITY:
+			__get_user( ulTemp, (unsigned long __user *)arg);
+			retval = dma_ll_set_cpu_affinity(dev, iDevice, ulTemp);
+			break;
+
+		case ZAP_IOC_R_CPU_PLACEMENT:
+			{
+				int cpu = dma_ll_cpu_placement(dev, iDevice);
+				unsigned long placement = cpu < 0 ? ZAP_CPU_PLACEMENT_NONE : (unsigned long)cpu;
+				__put_user( placement, (unsigned long __user *)arg);
+			}
+			break;
+
+		case ZAP_IOC_R_MMIO_OPS:
+			__put_user( dma_ll_mmio_ops(dev, iDevice), (unsigned long __user *)arg);
+			break;
+
+		case ZAP_IOC_RESET_MMIO_OPS:
+			dma_ll_reset_mmio_ops(dev, iDevice);
+			break;
+
+		case ZAP_IOC_R_DMA_COUNT:
+			{
+				unsigned long count = is_tx_device(filp) ? 
+					dma_ll_tx_dma_count(dev, iDevice) : dma_ll_rx_dma_count(dev, iDevice);
+				__put_user( count, (unsigned long __user *)arg);
+			}
+			break;
+
+		case ZAP_IOC_FPGA_RECONFIG:
+			retval = dma_reconfigure(dev);
+			break;
+
+		case ZAP_IOC_W_FWD_ZAP:
+			if ( is_tx_device(filp) ) {
+				retval = -EINVAL;
+				break;
+			}
+			__get_user( ulTemp, (unsigned long __user *)arg);
+			retval = zap_fwd_set_zap(dev, iDevice, ulTemp);
+			break;
+
+		case ZAP_IOC_W_FWD_SOCKET:
+			if ( is_tx_device(filp) ) {
+				retval = -EINVAL;
+				break;
+			}
+			__get_user( ulTemp, (unsigned long __user *)arg);
+			retval = zap_fwd_set_socket(dev, iDevice, (int) ulTemp);
+			break;
+
+		case ZAP_IOC_R_FWD_COUNT:
+			__put_user( atomic_long_read(&dev->interface[iDevice].fwd_count), (unsigned long __user *)arg);
+			break;
+
+		case ZAP_IOC_R_FWD_DROPS:
+			__put_user( atomic_long_read(&dev->interface[iDevice].fwd_drops), (unsigned long __user *)arg);
+			break;
+
 		default:  /* redundant, as cmd was checked against MAXNR */
 			retval = -ENOTTY;
 			break;
@@ -865,7 +946,7 @@ int zap_mmap(struct file *filp, struct vm_area_struct *vma)
 	if (requested_size > available_size) 
         return -EINVAL;
 
-    dev_info(zap_devp->dev, "mmap %s 0x%0llx -> 0x%0lx (0x%0lx)\n", 
+    dev_info(dev->dev, "mmap %s 0x%0llx -> 0x%0lx (0x%0lx)\n", 
             is_tx_device(filp) ? "tx":"rx", 
             pool_phys_start, vma->vm_start, pool_size);
 
@@ -937,27 +1018,41 @@ struct file_operations zap_fops = {
  */
 static int zap_remove(struct platform_device *pdev)
 {
+	struct zap_dev * zap_devp = platform_get_drvdata(pdev);
     int i;
 
     pr_info("zap - REMOVE\n");
 
-	dma_cleanup( zap_devp->num_devices );
-
 	if (zap_devp) {
-        for( i = 0; i < zap_devp->num_devices; i++) {
-	        pool_destroy(&zap_devp->interface[i].rx_pool);
-	        pool_destroy(&zap_devp->interface[i].tx_pool);
-            device_destroy( zap_devp->class, MKDEV(MAJOR(zap_devp->node),(i*2)) );
-            device_destroy( zap_devp->class, MKDEV(MAJOR(zap_devp->node),(i*2)+1) );
+        if (zap_devp->interface) {
+            for( i = 0; i < zap_devp->num_devices; i++)
+                zap_fwd_stop(zap_devp, i);
         }
-        class_destroy( zap_devp->class );
-        cdev_del(&zap_devp->cdev);
-        unregister_chrdev_region(zap_devp->node, zap_devp->num_devices * 2);
+
+		dma_cleanup( zap_devp );
+
+        if (zap_devp->interface) {
+            for( i = 0; i < zap_devp->num_devices; i++) {
+	            pool_destroy(&zap_devp->interface[i].rx_pool);
+	            pool_destroy(&zap_devp->interface[i].tx_pool);
+            }
+        }
+        if (zap_devp->node) {
+            for( i = 0; i < zap_devp->num_devices; i++) {
+                device_destroy( zap_devp->class, MKDEV(MAJOR(zap_devp->node),(i*2)) );
+                device_destroy( zap_devp->class, MKDEV(MAJOR(zap_devp->node),(i*2)+1) );
+            }
+            if (zap_devp->cdev.ops)
+                cdev_del(&zap_devp->cdev);
+            unregister_chrdev_region(zap_devp->node, zap_devp->num_devices * 2);
+        }
+        if (zap_devp->instance >= 0)
+            ida_free(&zap_ida, zap_devp->instance);
 
         if (zap_devp->interface)
             kfree(zap_devp->interface);
 		kfree(zap_devp);
-        zap_devp = NULL;
+	    platform_set_drvdata(pdev, NULL);
 	}
 
     return 0;
@@ -969,20 +1064,36 @@ static int zap_probe(struct platform_device *pdev)
     struct device_node *np;
     struct reserved_mem *rmem = NULL;
     u64 rx_pool_sz, tx_pool_sz;    
+	struct zap_dev * zap_devp;
+	int id;
 
     pr_info("zap - PROBE\n");
 
 	zap_devp = kzalloc(sizeof(struct zap_dev), GFP_KERNEL);
 	if (!zap_devp) {
-		err = -ENOMEM;
-		goto fail;
+		return -ENOMEM;
 	}
 	memset(zap_devp, 0, sizeof(struct zap_dev));
+	zap_devp->instance = -1;
     platform_set_drvdata(pdev, zap_devp);
 	zap_devp->dev = &pdev->dev;
+	zap_devp->class = zap_class;
+
+	// Nodes without an alias are numbered after all the aliased ones, so
+	// they can't take an aliased node's instance before it probes.
+	id = of_alias_get_id(pdev->dev.of_node, "zap");
+	if (id >= 0)
+		zap_devp->instance = ida_alloc_range(&zap_ida, id, id, GFP_KERNEL);
+	else
+		zap_devp->instance = ida_alloc_min(&zap_ida, max(of_alias_get_highest_id("zap") + 1, 0), GFP_KERNEL);
+	if (zap_devp->instance < 0) {
+		err = zap_devp->instance;
+		goto fail;
+	}
+	dev_info(zap_devp->dev, "instance %d\n", zap_devp->instance);
 
     err = of_property_read_u32(pdev->dev.of_node, "num-devices", &zap_devp->num_devices);
-    if ( err )
+    if ( err || zap_devp->num_devices > ZAP_MAX_DEVICES )
         zap_devp->num_devices = ZAP_MAX_DEVICES;
     dev_info(zap_devp->dev, "num_devices %u\n", zap_devp->num_devices);
 
@@ -1015,7 +1126,8 @@ static int zap_probe(struct platform_device *pdev)
     rmem = of_reserved_mem_lookup(np);
 	if (!rmem) {
 		dev_err(zap_devp->dev, "unable to acquire memory-region\n");
-		return -EINVAL;
+		err = -EINVAL;
+		goto fail;
     }
 
     dev_info(zap_devp->dev, "memory-region: 0x%0llx 0x%0llx\n", rmem->base, rmem->size);
@@ -1040,26 +1152,17 @@ static int zap_probe(struct platform_device *pdev)
 
     //create_proc_read_entry("iveia/zap", 0, NULL, zap_read_procmem, NULL);
 	/*
-	 * Get a range of minor numbers to work with, using static major.
+	 * Get a range of minor numbers to work with.
 	 *
-	 * For each ZAP FPGA instance, we create 2 minor numbers that point to the
-	 * same cdev.  One is for tx buffers, the other for rx buffers.
-	 *
-	 * Even though ZAP_MAX_DEVICES is defined, we currently only support one
-	 * ZAP instance, and we only create one cdev.
+	 * For each ZAP interface, we create 2 minor numbers that point to the
+	 * same cdev.  One is for tx buffers, the other for rx buffers.  Each ZAP
+	 * instance (FPGA core) has its own region and cdev.
 	 */
 	err = alloc_chrdev_region(&zap_devp->node, 0, zap_devp->num_devices * 2, MODNAME);
 	if (err) {
 		goto fail;
 	}
 
-	zap_devp->class = class_create(THIS_MODULE, "zap");
-	if (IS_ERR(zap_devp->class)){
-		err = PTR_ERR(zap_devp->class);
-		goto fail;
-	}
-
-	
     sema_init(&zap_devp->sem, 1);
 
 	cdev_init(&zap_devp->cdev, &zap_fops);
@@ -1088,10 +1191,21 @@ static int zap_probe(struct platform_device *pdev)
 	    zap_devp->interface[i].tx_header_enable = 0;
 	    zap_devp->interface[i].rx_header_size = 0;
 	    zap_devp->interface[i].tx_header_size = 0;
-		device_create(zap_devp->class, NULL, MKDEV(MAJOR(zap_devp->node),i*2), NULL, "zaprx%d",i);
-		device_create(zap_devp->class, NULL, MKDEV(MAJOR(zap_devp->node),(i*2)+1), NULL, "zaptx%d",i);
+		//
+		// Instance 0 keeps the original node names.
+		//
+		if (zap_devp->instance == 0) {
+			device_create(zap_devp->class, NULL, MKDEV(MAJOR(zap_devp->node),i*2), NULL, "zaprx%d",i);
+			device_create(zap_devp->class, NULL, MKDEV(MAJOR(zap_devp->node),(i*2)+1), NULL, "zaptx%d",i);
+		} else {
+			device_create(zap_devp->class, NULL, MKDEV(MAJOR(zap_devp->node),i*2), NULL, 
+				"zap%d_rx%d", zap_devp->instance, i);
+			device_create(zap_devp->class, NULL, MKDEV(MAJOR(zap_devp->node),(i*2)+1), NULL, 
+				"zap%d_tx%d", zap_devp->instance, i);
+		}
 	    zap_devp->interface[i].rx_jumbo_pkt_enable = 0;
 	    zap_devp->interface[i].tx_jumbo_pkt_enable = 0;
+	    zap_fwd_init(zap_devp, i);
     }
 
     dma_set_coherent_mask(zap_devp->dev, 0xFFFFFFFF);
@@ -1113,6 +1227,20 @@ static int zap_probe(struct platform_device *pdev)
 		goto fail;
 	}
 
+    //
+    // Optional per-interface CPU masks.  Missing entries mean no affinity.
+    //
+    for (i = 0; i < zap_devp->num_devices; i++ ) {
+        u32 cpu_mask;
+
+        if ( of_property_read_u32_index(pdev->dev.of_node, "cpu-affinity", i, &cpu_mask ) != 0 )
+            break;
+        if ( cpu_mask == 0 )
+            continue;
+        if ( dma_ll_set_cpu_affinity(zap_devp, i, cpu_mask) )
+            dev_warn(zap_devp->dev, "invalid cpu-affinity 0x%x for interface %d\n", cpu_mask, i);
+    }
+
 	return 0;
 
   fail:
@@ -1135,7 +1263,31 @@ static struct platform_driver zap_driver = {
 		.of_match_table = zap_of_match,
 	},
 };
-module_platform_driver(zap_driver);
+
+static int __init zap_init(void)
+{
+	int err;
+
+	zap_class = class_create(THIS_MODULE, "zap");
+	if (IS_ERR(zap_class))
+		return PTR_ERR(zap_class);
+
+	err = platform_driver_register(&zap_driver);
+	if (err)
+		class_destroy(zap_class);
+
+	return err;
+}
+
+static void __exit zap_exit(void)
+{
+	platform_driver_unregister(&zap_driver);
+	class_destroy(zap_class);
+	ida_destroy(&zap_ida);
+}
+
+module_init(zap_init);
+module_exit(zap_exit);
 
 MODULE_DESCRIPTION("iVeia ZAP driver");
 MODULE_AUTHOR("iVeia, LLC");
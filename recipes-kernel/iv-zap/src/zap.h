@@ -51,7 +51,32 @@
 #define ZAP_IOC_R_TX_JUMBO_EN		_IOR(ZAP_IOC_MAGIC,  29, unsigned long)
 #define ZAP_IOC_W_TX_JUMBO_EN		_IOR(ZAP_IOC_MAGIC,  30, unsigned long)
 
-#define ZAP_IOC_MAXNR 30 
+#define ZAP_IOC_R_CPU_AFFINITY		_IOR(ZAP_IOC_MAGIC,  31, unsigned long)
+#define ZAP_IOC_W_CPU_AFFINITY		_IOW(ZAP_IOC_MAGIC,  32, unsigned long)
+#define ZAP_IOC_R_CPU_PLACEMENT		_IOR(ZAP_IOC_MAGIC,  33, unsigned long)
+
+// Register accesses made by the driver for an interface (both directions),
+// and DMAs completed in the fd's direction since it was started.  Dividing
+// the first by the sum of the RX and TX counts gives MMIO ops per packet.
+// RESET_MMIO_OPS resets the counter.
+#define ZAP_IOC_R_MMIO_OPS		_IOR(ZAP_IOC_MAGIC,  34, unsigned long)
+#define ZAP_IOC_RESET_MMIO_OPS		_IO(ZAP_IOC_MAGIC,  35)
+#define ZAP_IOC_R_DMA_COUNT		_IOR(ZAP_IOC_MAGIC,  36, unsigned long)
+
+// Re-read the FPGA after a (partial) reconfiguration and resume DMA.
+#define ZAP_IOC_FPGA_RECONFIG		_IO(ZAP_IOC_MAGIC,  37)
+
+// Forward an RX interface's packets in the kernel instead of queueing them
+// for read().  Issue on the zaprx fd.  FWD_ZAP takes the index of a TX
+// interface on the same ZAP instance (zero-copy); FWD_SOCKET takes the fd of
+// a connected UDP socket.  ZAP_FWD_OFF (or -1 for the socket fd) stops
+// forwarding.  The counters reset each time forwarding is set up.
+#define ZAP_IOC_W_FWD_ZAP		_IOW(ZAP_IOC_MAGIC,  38, unsigned long)
+#define ZAP_IOC_W_FWD_SOCKET		_IOW(ZAP_IOC_MAGIC,  39, unsigned long)
+#define ZAP_IOC_R_FWD_COUNT		_IOR(ZAP_IOC_MAGIC,  40, unsigned long)
+#define ZAP_IOC_R_FWD_DROPS		_IOR(ZAP_IOC_MAGIC,  41, unsigned long)
+
+#define ZAP_IOC_MAXNR 41 
 
 /*
  * Ioctl argument values.
@@ -63,6 +88,17 @@
 #define IV_ZAP_OPT_FAKEY_MODE_LOOPBACK      (3)
 #define IV_ZAP_OPT_FAKEY_MODE_DELAYED_RECV  (4)
 
+/*
+ * CPU affinity is a bitmask of CPUs (bit N is CPU N) that the interface's
+ * IRQ and RX refill worker are pinned to.  Zero means no affinity.  The
+ * placement is the single CPU actually chosen from the mask, so the consumer
+ * thread can pin itself there and keep the hot path in one cache domain.
+ */
+#define ZAP_CPU_PLACEMENT_NONE              ((unsigned long) -1)
+
+/* FWD_ZAP target that stops forwarding */
+#define ZAP_FWD_OFF                         ((unsigned long) -1)
+
 #define ZAP_DESC_FLAG_OVERFLOW_OOB              (0x02)
 #define ZAP_DESC_FLAG_OVERFLOW_DATA             (0x04)
 #define ZAP_DESC_FLAG_INVALID_APP_DATA          (0x08)
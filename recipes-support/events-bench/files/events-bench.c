@@ -0,0 +1,272 @@
+/*
+ * Events driver benchmark
+ *
+ * Drives the events driver's debugfs load generator, with N subscribers
+ * reading queue-mode records, and reports per-subscriber delivery latency
+ * (load generator step to read() return) and loss.
+ *
+ * (C) Copyright 2021, iVeia, LLC
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include "_events.h"
+
+#define EVENTS_DEV      "/dev/events"
+#define LOADGEN_DIR     "/sys/kernel/debug/events/loadgen/"
+#define LAT_BUCKETS     32
+#define READ_RECORDS    64
+#define DRAIN_MS        500
+
+struct subscriber {
+    pthread_t thread;
+    int fd;
+    unsigned long received;
+    unsigned long gaps;         // Records the driver dropped (sequence gaps)
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    unsigned long hist[LAT_BUCKETS];
+};
+
+static volatile int done = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int log2_bucket(uint64_t ns)
+{
+    int b = 0;
+
+    while (ns >>= 1)
+        b++;
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+static int write_attr(const char * name, const char * val)
+{
+    char path[256];
+    int fd, len;
+
+    snprintf(path, sizeof(path), LOADGEN_DIR "%s", name);
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    len = write(fd, val, strlen(val));
+    close(fd);
+    if (len < 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static unsigned long long read_attr(const char * name)
+{
+    char path[256];
+    char buf[64];
+    int fd, len;
+
+    snprintf(path, sizeof(path), LOADGEN_DIR "%s", name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0) {
+        perror(path);
+        exit(1);
+    }
+    buf[len] = '\0';
+    return strtoull(buf, NULL, 0);
+}
+
+static void * subscriber_task(void * arg)
+{
+    struct subscriber * sub = arg;
+    struct events_record recs[READ_RECORDS];
+    struct pollfd pfd = { .fd = sub->fd, .events = POLLIN };
+    uint32_t next_seq = 0;
+    uint64_t now, lat;
+    int n, i;
+
+    for (;;) {
+        n = poll(&pfd, 1, DRAIN_MS);
+        if (n == 0 && done)
+            break;
+        if (n <= 0)
+            continue;
+
+        n = read(sub->fd, recs, sizeof(recs));
+        now = now_ns();
+        if (n < 0) {
+            perror("read");
+            break;
+        }
+
+        for (i = 0; i < n / (int)sizeof(struct events_record); i++) {
+            lat = now - recs[i].timestamp;
+            if (sub->received == 0 || lat < sub->lat_min)
+                sub->lat_min = lat;
+            if (lat > sub->lat_max)
+                sub->lat_max = lat;
+            sub->lat_sum += lat;
+            sub->hist[log2_bucket(lat)]++;
+            sub->gaps += recs[i].seq - next_seq;
+            next_seq = recs[i].seq + 1;
+            sub->received++;
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t hist_percentile(struct subscriber * sub, int pct)
+{
+    unsigned long target = (sub->received * pct + 99) / 100;
+    unsigned long count = 0;
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        count += sub->hist[i];
+        if (count >= target)
+            return 2ULL << i;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct subscriber * subs;
+    struct events_subscription subscription;
+    uint32_t words[2];
+    unsigned long long mask = 0x1;
+    unsigned long period_ns = 100000;
+    unsigned long passes = 10000;
+    unsigned long depth = 256;
+    unsigned long long injected;
+    int nsubs = 1;
+    char buf[64];
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:m:p:c:q:")) != -1) {
+        switch (opt) {
+            case 'n': nsubs = strtol(optarg, NULL, 0); break;
+            case 'm': mask = strtoull(optarg, NULL, 0); break;
+            case 'p': period_ns = strtoul(optarg, NULL, 0); break;
+            case 'c': passes = strtoul(optarg, NULL, 0); break;
+            case 'q': depth = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr,
+                    "Summary: Benchmark events delivery with the events load generator\n"
+                    "Usage: %s [-n subscribers] [-m mask] [-p period_ns] [-c count] [-q depth]\n"
+                    "    -n: Subscribers, each with its own fd and thread.  Default 1.\n"
+                    "    -m: Events (0-63) to inject on each step.  Default 0x1.\n"
+                    "    -p: Time between steps in ns.  Default 100000.\n"
+                    "    -c: Steps to run.  Default 10000.\n"
+                    "    -q: Queue depth of each subscriber, in records.  Default 256.\n"
+                    "\n"
+                    "Needs debugfs mounted, and root.\n",
+                    argv[0]);
+                exit(1);
+        }
+    }
+    if (nsubs < 1 || mask == 0 || passes == 0) {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(1);
+    }
+
+    subs = calloc(nsubs, sizeof(struct subscriber));
+    if (!subs) {
+        perror("calloc");
+        exit(1);
+    }
+
+    words[0] = (uint32_t)mask;
+    words[1] = (uint32_t)(mask >> 32);
+    subscription.flags = 0;
+    subscription.nbits = (mask >> 32) ? 64 : 32;
+    subscription.mask = (uintptr_t)words;
+
+    for (i = 0; i < nsubs; i++) {
+        subs[i].fd = open(EVENTS_DEV, O_RDWR);
+        if (subs[i].fd < 0) {
+            perror(EVENTS_DEV);
+            exit(1);
+        }
+        if (ioctl(subs[i].fd, EVENTS_IOC_W_QUEUE_DEPTH, &depth) < 0) {
+            perror("EVENTS_IOC_W_QUEUE_DEPTH");
+            exit(1);
+        }
+        if (ioctl(subs[i].fd, EVENTS_IOC_W_SUBSCRIBE, &subscription) < 0) {
+            perror("EVENTS_IOC_W_SUBSCRIBE");
+            exit(1);
+        }
+        if (pthread_create(&subs[i].thread, NULL, subscriber_task, &subs[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    snprintf(buf, sizeof(buf), "0x%llx\n", mask);
+    if (write_attr("enable", "0") || write_attr("sequence", buf))
+        exit(1);
+    snprintf(buf, sizeof(buf), "%lu", period_ns);
+    if (write_attr("period_ns", buf))
+        exit(1);
+    snprintf(buf, sizeof(buf), "%lu", passes);
+    if (write_attr("passes", buf))
+        exit(1);
+    if (write_attr("enable", "1"))
+        exit(1);
+
+    while (read_attr("enable"))
+        usleep(10000);
+    injected = read_attr("injected");
+
+    done = 1;
+    for (i = 0; i < nsubs; i++) {
+        pthread_join(subs[i].thread, NULL);
+        close(subs[i].fd);
+    }
+
+    printf("injected %llu events, %lu steps every %lu ns, %d subscribers\n",
+        injected, passes, period_ns, nsubs);
+    printf("%4s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+        "sub", "received", "lost", "dropped", "min_ns", "avg_ns", "p50_ns", "p99_ns", "max_ns");
+    for (i = 0; i < nsubs; i++) {
+        struct subscriber * sub = &subs[i];
+        printf("%4d %10lu %10llu %10lu %10llu %10llu %10llu %10llu %10llu\n",
+            i, sub->received,
+            injected > sub->received ? injected - sub->received : 0,
+            sub->gaps,
+            (unsigned long long)sub->lat_min,
+            (unsigned long long)(sub->received ? sub->lat_sum / sub->received : 0),
+            (unsigned long long)hist_percentile(sub, 50),
+            (unsigned long long)hist_percentile(sub, 99),
+            (unsigned long long)sub->lat_max);
+    }
+    printf("lost: injected but not received (coalesced or dropped); "
+        "dropped: queue overruns; p50/p99 are log2 bucket upper bounds\n");
+
+    free(subs);
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * OCP read()/write() throughput benchmark
+ *
+ * Times bulk read() (and optionally write()) of an OCP address space, with
+ * the driver's bounce buffered burst path and with the direct copy path, and
+ * an mmap() word loop for reference.  Run it once against a register file and
+ * once against a BRAM to compare.
+ *
+ * (C) Copyright 2021, iVeia, LLC
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define BURST_PARAM "/sys/module/iv_ocp/parameters/burst"
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int set_burst(int on)
+{
+    int fd = open(BURST_PARAM, O_WRONLY);
+
+    if (fd < 0) {
+        perror(BURST_PARAM);
+        return -1;
+    }
+    if (write(fd, on ? "1" : "0", 1) != 1) {
+        perror(BURST_PARAM);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static double bench_rw(int fd, void * buf, off_t offset, size_t size, int iterations, int do_write)
+{
+    double start = now_s();
+    ssize_t n;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        if (do_write)
+            n = pwrite(fd, buf, size, offset);
+        else
+            n = pread(fd, buf, size, offset);
+        if (n != (ssize_t)size) {
+            perror(do_write ? "pwrite" : "pread");
+            exit(1);
+        }
+    }
+
+    return (double)size * iterations / (now_s() - start) / 1e6;
+}
+
+static double bench_mmap(void * map, void * buf, size_t size, int iterations, int do_write)
+{
+    volatile uint32_t * reg = map;
+    uint32_t * word = buf;
+    double start = now_s();
+    size_t j;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < size / sizeof(uint32_t); j++) {
+            if (do_write)
+                reg[j] = word[j];
+            else
+                word[j] = reg[j];
+        }
+    }
+
+    return (double)size * iterations / (now_s() - start) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int fd;
+    void * buf;
+    void * map;
+    off_t offset;
+    size_t size;
+    int iterations = 100;
+    int do_write = 0;
+    int burst;
+    off_t pgmask = sysconf(_SC_PAGESIZE) - 1;
+
+    if (argc > 1 && strcmp(argv[1], "-w") == 0) {
+        do_write = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc < 4 || argc > 5) {
+        fprintf(stderr,
+            "Summary: Benchmark OCP read()/write() throughput\n"
+            "Usage: %s [-w] <device> <offset> <size> [iterations]\n"
+            "    -w: Also benchmark writes.  Overwrites the range with what was read!\n"
+            "    device: OCP address space, e.g. /dev/ocp0\n"
+            "    offset, size: Range to access, in bytes.  Multiples of 4.\n"
+            "    iterations: Times to access the range.  Default 100.\n",
+            argv[0]);
+        exit(1);
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+    offset = strtoull(argv[2], NULL, 0);
+    size = strtoull(argv[3], NULL, 0);
+    if (argc == 5)
+        iterations = strtol(argv[4], NULL, 0);
+    if (size == 0 || size % 4 || offset % 4 || iterations < 1) {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(1);
+    }
+
+    buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    printf("%s 0x%llx + 0x%zx, %d iterations\n", argv[1], (unsigned long long)offset, size, iterations);
+    printf("%-8s %10s %10s\n", "path", "read MB/s", "write MB/s");
+
+    for (burst = 0; burst <= 1; burst++) {
+        double rd, wr = 0;
+
+        if (set_burst(burst))
+            exit(1);
+        rd = bench_rw(fd, buf, offset, size, iterations, 0);
+        if (do_write)
+            wr = bench_rw(fd, buf, offset, size, iterations, 1);
+        printf("%-8s %10.1f %10.1f\n", burst ? "burst" : "direct", rd, wr);
+    }
+    set_burst(1);
+
+    map = mmap(NULL, (offset & pgmask) + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset & ~pgmask);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+    } else {
+        void * p = (char *)map + (offset & pgmask);
+        double rd, wr = 0;
+
+        rd = bench_mmap(p, buf, size, iterations, 0);
+        if (do_write)
+            wr = bench_mmap(p, buf, size, iterations, 1);
+        printf("%-8s %10.1f %10.1f\n", "mmap", rd, wr);
+        munmap(map, (offset & pgmask) + size);
+    }
+
+    free(buf);
+    close(fd);
+    return 0;
+}